@@ -3,6 +3,8 @@
 #include "ID.hpp"
 
 #include <atomic>
+#include <cstddef>
+#include <tuple>
 #include <type_traits>
 #include <cassert>
 
@@ -90,11 +92,6 @@ namespace Kunlaboro
 		 *
 		 * Each component can only be held by a single entity at a time,
 		 * so this is guaranteed to be either a valid entity or EntityId::Invalid()
-		 *
-		 * \note This function will require iterating the entity table,
-		 *       so performance is O(n) on number of existing entities.
-		 *       Recommended is to cache the resulting value if it's to
-		 *       be used repeatedly.
 		 */
 		EntityId getEntityId() const;
 
@@ -103,6 +100,24 @@ namespace Kunlaboro
 		/// Gets a const pointer to the entity system that owns the component.
 		const EntitySystem* getEntitySystem() const;
 
+	protected:
+		/** Called directly by the entity system when the component is attached to an entity.
+		 *
+		 * Unlike listening for EntitySystem::ComponentAttachedEvent, this is
+		 * only ever called on the component that was attached, so it costs
+		 * nothing for all the other components in the system.
+		 *
+		 * \param eid The ID of the entity the component was attached to.
+		 * \note This is called before the ComponentAttachedEvent is emitted.
+		 */
+		virtual void onAttached(EntityId eid) { (void)eid; }
+		/** Called directly by the entity system when the component is detached from an entity.
+		 *
+		 * \param eid The ID of the entity the component was detached from.
+		 * \note This is called before the ComponentDetachedEvent is emitted.
+		 */
+		virtual void onDetached(EntityId eid) { (void)eid; }
+
 	private:
 		friend class EntitySystem;
 
@@ -114,6 +129,57 @@ namespace Kunlaboro
 		ComponentId mId;
 	};
 
+	/** A component base class that stores its fields as a structure of arrays.
+	 *
+	 * Instead of storing the given fields inside of the component object,
+	 * each field is stored in its own contiguous column in the pool memory.
+	 * This lets loops that only touch some of the fields stream through just
+	 * the data they need, and keeps the data ready for vectorization.
+	 *
+	 * Fields are identified by their index, and accessed through field(),
+	 * or in bulk through ComponentView::forEachFields().
+	 *
+	 * \code{.cpp}
+	 * struct Position : public Kunlaboro::SoAComponent<Position, float, float, float>
+	 * {
+	 * 	enum { X, Y, Z };
+	 *
+	 * 	Position(float x, float y, float z)
+	 * 	{
+	 * 		field<X>() = x;
+	 * 		field<Y>() = y;
+	 * 		field<Z>() = z;
+	 * 	}
+	 * };
+	 * \endcode
+	 *
+	 * \tparam Derived The component type deriving from this class.
+	 * \tparam Fields The types of the fields, must be trivially copyable.
+	 *
+	 * \note Accessing single fields through field() requires looking up the
+	 *       pool of the component, prefer the view methods for bulk work.
+	 * \note Copy-constructing a component does not copy its fields.
+	 */
+	template<typename Derived, typename... Fields>
+	class SoAComponent : public Component
+	{
+	public:
+		static_assert(sizeof...(Fields) > 0, "Structure of array components need at least one field");
+
+		/// The types of all the fields in the component.
+		typedef std::tuple<Fields...> FieldTypes;
+		/// The type of the field with the given index.
+		template<std::size_t I>
+		using FieldType = typename std::tuple_element<I, FieldTypes>::type;
+
+		/// Gets a reference to the field with the given index.
+		template<std::size_t I>
+		FieldType<I>& field();
+		/// Gets a const reference to the field with the given index.
+		template<std::size_t I>
+		const FieldType<I>& field() const;
+	};
+
 	/** Method for looking up component family IDs.
 	 * 
 	 * \todo Make this nicer, possibly allowing for runtime lookup as well.
@@ -110,6 +110,92 @@ namespace Kunlaboro
 			EntitySystem* ES;
 		};
 
+		/** This event is emitted once for every batch of created entities.
+		 *
+		 * Outside of a batch, this is emitted with a single entity right
+		 * after the matching EntityCreatedEvent.
+		 *
+		 * \note The IDs are only valid while the event is being emitted,
+		 *       so batched events can't be listened to asynchronously.
+		 *
+		 * \sa beginBatch()
+		 */
+		struct EntitiesCreatedEvent
+		{
+			enum { sBorrowed = true };
+
+			/// The IDs of the entities that were created.
+			const EntityId* Entities;
+			/// The number of entities in the batch.
+			std::size_t Count;
+			/// The entity system from where the event originates.
+			EntitySystem* ES;
+		};
+		/** This event is emitted once for every batch of destroyed entities.
+		 *
+		 * \sa EntitiesCreatedEvent
+		 */
+		struct EntitiesDestroyedEvent
+		{
+			enum { sBorrowed = true };
+
+			/// The IDs of the entities that were destroyed.
+			const EntityId* Entities;
+			/// The number of entities in the batch.
+			std::size_t Count;
+			/// The entity system from where the event originates.
+			EntitySystem* ES;
+		};
+		/** This event is emitted once for every batch of attached components.
+		 *
+		 * \sa EntitiesCreatedEvent
+		 */
+		struct ComponentsAttachedEvent
+		{
+			enum { sBorrowed = true };
+
+			/// The IDs of the components that were attached.
+			const ComponentId* Components;
+			/// The IDs of the entities they were attached to, in the same order.
+			const EntityId* Entities;
+			/// The number of components in the batch.
+			std::size_t Count;
+			/// The entity system from where the event originates.
+			EntitySystem* ES;
+		};
+		/** This event is emitted once for every batch of detached components.
+		 *
+		 * \sa EntitiesCreatedEvent
+		 */
+		struct ComponentsDetachedEvent
+		{
+			enum { sBorrowed = true };
+
+			/// The IDs of the components that were detached.
+			const ComponentId* Components;
+			/// The IDs of the entities they were detached from, in the same order.
+			const EntityId* Entities;
+			/// The number of components in the batch.
+			std::size_t Count;
+			/// The entity system from where the event originates.
+			EntitySystem* ES;
+		};
+		/** This event is emitted once for every batch of destroyed components.
+		 *
+		 * \sa EntitiesCreatedEvent
+		 */
+		struct ComponentsDestroyedEvent
+		{
+			enum { sBorrowed = true };
+
+			/// The IDs of the components that were destroyed.
+			const ComponentId* Components;
+			/// The number of components in the batch.
+			std::size_t Count;
+			/// The entity system from where the event originates.
+			EntitySystem* ES;
+		};
+
 		EntitySystem();
 		EntitySystem(const EntitySystem&) = delete;
 		~EntitySystem();
@@ -227,6 +313,8 @@ namespace Kunlaboro
 		 * This sanity check takes a while to run, so it might be
 		 * desired to skip it when collisions are guaranteed not to occur.
 		 * \endparblock
+		 *
+		 * \sa Component::onAttached()
 		 */
 		void attachComponent(ComponentId cid, EntityId eid, bool checkDetach = true);
 		/** Detaches the component with the given ID from the given entity ID.
@@ -236,14 +324,14 @@ namespace Kunlaboro
 		 *
 		 * \note If the entity is the only thing keeping a handle to the component
 		 *       then this method might result in the component being destroyed.
+		 * \sa Component::onDetached()
 		 */
 		void detachComponent(ComponentId cid, EntityId eid);
 
 		/** Gets the ID of the entity that the given component ID is attached to.
 		 *
 		 * \param cid The ID of the component to check.
-		 * \note This method is O(n) on number of entities,
-		 *       so caching the return value is recommended.
+		 * \returns The entity ID, or EntityId::Invalid() if the component isn't attached.
 		 */
 		EntityId getEntity(ComponentId cid) const;
 
@@ -266,6 +354,33 @@ namespace Kunlaboro
 		 */
 		const MessageSystem& getMessageSystem() const;
 
+		/** Starts batching lifecycle events.
+		 *
+		 * Until the matching endBatch(), creating and destroying entities as
+		 * well as attaching, detaching and destroying components only records
+		 * the change, instead of emitting events for it.
+		 *
+		 * Batches can be nested, only the outermost endBatch() emits.
+		 *
+		 * \code{.cpp}
+		 * es.beginBatch();
+		 * for (auto eid : despawned)
+		 * 	es.destroyEntity(eid);
+		 * es.endBatch(); // A single EntitiesDestroyedEvent
+		 * \endcode
+		 */
+		void beginBatch();
+		/** Ends a batch of lifecycle events.
+		 *
+		 * When ending the outermost batch, each batched event is emitted once
+		 * with all the recorded IDs. The single events are then emitted for
+		 * every recorded change in the order the changes happened, if anything
+		 * is listening to them.
+		 */
+		void endBatch();
+		/// Checks if lifecycle events are currently being batched.
+		inline bool isBatching() const { return mBatchDepth > 0; }
+
 		/** Cleans up old component data.
 		 *
 		 * \todo Allow clearing up certain component families, instead
@@ -284,11 +399,13 @@ namespace Kunlaboro
 			ComponentData()
 				: Generation(0)
 				, RefCount(new std::atomic_ushort(0))
+				, Entity(EntityId::Invalid())
 			{ }
 			ComponentData(const ComponentData&) = delete;
 			ComponentData(ComponentData&& move)
 				: Generation(std::move(move.Generation))
 				, RefCount(std::move(move.RefCount))
+				, Entity(std::move(move.Entity))
 			{
 				move.RefCount = nullptr;
 			}
@@ -300,6 +417,8 @@ namespace Kunlaboro
 
 			ComponentId::GenerationType Generation;
 			std::atomic_ushort* RefCount;
+			/// The entity the component is attached to, or EntityId::Invalid().
+			EntityId Entity;
 		};
 		struct EntityData
 		{
@@ -332,5 +451,29 @@ namespace Kunlaboro
 
 		EventSystem* mEventSystem;
 		MessageSystem* mMessageSystem;
+
+		/// The number of nested batches currently running.
+		std::uint32_t mBatchDepth;
+		/// Changes recorded during the current batch.
+		std::vector<EntityId> mCreatedEntities, mDestroyedEntities;
+		/// Attached components, and the entities they were attached to.
+		std::vector<ComponentId> mAttachedComponents;
+		std::vector<EntityId> mAttachedEntities;
+		/// Detached components, and the entities they were detached from.
+		std::vector<ComponentId> mDetachedComponents;
+		std::vector<EntityId> mDetachedEntities;
+		std::vector<ComponentId> mDestroyedComponents;
+
+		/// The kinds of changes recorded in a batch.
+		enum BatchedChange : std::uint8_t
+		{
+			sBatchedCreate,
+			sBatchedAttach,
+			sBatchedDetach,
+			sBatchedDestroyComponent,
+			sBatchedDestroy
+		};
+		/// The kind of every recorded change, in the order they happened.
+		std::vector<std::uint8_t> mBatchOrder;
 	};
 }
@@ -52,6 +52,7 @@ namespace Kunlaboro
 		component.RefCount->store(0);
 
 		pool->setBit(index);
+		pool->initialize(index);
 		auto* comp = static_cast<T*>(pool->getData(index));
 
 		auto id = ComponentId(index, component.Generation, family);
@@ -72,4 +73,22 @@ namespace Kunlaboro
 		return ComponentHandle<T>(comp, component.RefCount);
 	}
 
+	template<typename Derived, typename... Fields>
+	template<std::size_t I>
+	typename SoAComponent<Derived, Fields...>::template FieldType<I>& SoAComponent<Derived, Fields...>::field()
+	{
+		static_assert(std::is_trivially_copyable<FieldType<I>>::value, "Structure of array fields must be trivially copyable.");
+
+		const auto& id = getId();
+		auto& pool = const_cast<detail::BaseComponentPool&>(getEntitySystem()->componentGetPool(id.getFamily()));
+		return static_cast<detail::ComponentPool<Derived>&>(pool).template getField<I>(id.getIndex());
+	}
+
+	template<typename Derived, typename... Fields>
+	template<std::size_t I>
+	const typename SoAComponent<Derived, Fields...>::template FieldType<I>& SoAComponent<Derived, Fields...>::field() const
+	{
+		return const_cast<SoAComponent*>(this)->template field<I>();
+	}
+
 }
@@ -1,16 +1,79 @@
 #pragma once
 
 #include "ID.hpp"
+#include "detail/FunctorStorage.hpp"
+#include "detail/MPSCQueue.hpp"
 
-#include <functional>
-#include <typeindex>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace Kunlaboro
 {
 
 	class EntitySystem;
+	namespace detail
+	{
+		class JobQueue;
+
+		/** Looks up the key of the given type in an event, for scoped listeners.
+		 *
+		 * Events with an Entity member can be scoped by EntityId, and events
+		 * with a Component member can be scoped by ComponentId.
+		 */
+		template<typename Key, typename Event, typename = void>
+		struct EventKey : std::false_type { };
+		template<typename Event>
+		struct EventKey<EntityId, Event, typename std::enable_if<std::is_convertible<decltype(std::declval<const Event&>().Entity), EntityId>::value>::type> : std::true_type
+		{
+			static EntityId get(const Event& ev) { return ev.Entity; }
+		};
+		template<typename Event>
+		struct EventKey<ComponentId, Event, typename std::enable_if<std::is_convertible<decltype(std::declval<const Event&>().Component), ComponentId>::value>::type> : std::true_type
+		{
+			static ComponentId get(const Event& ev) { return ev.Component; }
+		};
+
+		/** Checks if an event only borrows the data it points to from the emitter.
+		 *
+		 * Events mark this by declaring an enum value sBorrowed, such events
+		 * are only valid while being emitted.
+		 */
+		template<typename Event, typename = void>
+		struct IsBorrowedEvent : std::false_type { };
+		template<typename Event>
+		struct IsBorrowedEvent<Event, typename std::enable_if<bool(Event::sBorrowed)>::type> : std::true_type { };
+	}
+
+	struct BaseEventFamily
+	{
+	protected:
+		static std::size_t sFamilyCounter;
+	};
+
+	/** Method for looking up the dense index of an event type.
+	 *
+	 * \tparam Event The event type.
+	 */
+	template<typename Event>
+	class EventFamily : BaseEventFamily
+	{
+	public:
+		/** Retrieves the index of the requested event type.
+		 *
+		 * \note Like component families, this is backed by a global counter.
+		 */
+		static std::size_t getFamily()
+		{
+			static std::size_t sFamily = sFamilyCounter++;
+			return sFamily;
+		}
+	};
 
 	/** A low-level event emitting system.
 	 *
@@ -22,17 +85,12 @@ namespace Kunlaboro
 	class EventSystem
 	{
 	public:
-		/** The base type of all registered events.
+		/** Handle to a loose listener.
 		 *
-		 * Should never be used for anything, is only
-		 * public to help code locality later on.
+		 * Made up of a slot index and the generation of that slot, so a
+		 * handle stays unique even after the listener is unregistered.
 		 */
-		struct BaseEvent {
-			/// The type of the event, Component or Loose.
-			std::uint8_t Type;
-		};
-
-		typedef std::size_t ListenerId;
+		typedef std::uint64_t ListenerId;
 
 		EventSystem(const EventSystem&) = delete;
 		EventSystem(EventSystem&&) = delete;
@@ -58,14 +116,90 @@ namespace Kunlaboro
 		 * \param func The functor to call when the event is emitted.
 		 * \returns The ID of the registered listener, this value is
 		 *          needed for future unregistering.
+		 * \note This function is O(1).
 		 *
 		 * \sa unregisterEvent(ListenerId)
 		 */
 		template<typename Event, typename Functor>
 		ListenerId registerEvent(Functor&& func);
+		/** Register an asynchronous listener for the given event.
+		 *
+		 * Emitting the event copies it into a lock-free queue, and the
+		 * listener is called later on from a worker of the job queue set
+		 * with setJobQueue(). Without a job queue, the queued events are
+		 * only delivered by drain().
+		 *
+		 * The asynchronous listeners of an event type receive the events
+		 * one at a time, in the order they were emitted.
+		 *
+		 * \tparam Event The event to listen for, must be copy constructible
+		 *               and can't borrow its data from the emitter.
+		 *               Trivially copyable events are queued without allocating.
+		 * \param func The functor to call when the event is delivered.
+		 * \returns The ID of the registered listener, for unregisterEvent(ListenerId).
+		 * \note Registering waits for any running delivery of the event type.
+		 *
+		 * \sa drain()
+		 */
+		template<typename Event, typename Functor>
+		ListenerId registerAsyncEvent(Functor&& func);
+		/** Register a loose listener for the events of a single entity.
+		 *
+		 * The listener is only called for events whose Entity member matches
+		 * the given ID, without being called for any of the other events.
+		 *
+		 * \code{.cpp}
+		 * eventSystem.registerScopedEvent<EntitySystem::ComponentAttachedEvent>(entityId, [](auto& ev) { });
+		 * \endcode
+		 *
+		 * \tparam Event The event to listen for, must have an Entity member.
+		 * \param eId The ID of the entity to listen for.
+		 * \param func The functor to call when the event is emitted.
+		 * \returns The ID of the registered listener, for unregisterEvent(ListenerId).
+		 * \note Scoped listeners are not removed when the entity is destroyed.
+		 * \sa registerScopedEvent(ComponentId, EntityId, Functor&&)
+		 */
+		template<typename Event, typename Functor>
+		ListenerId registerScopedEvent(EntityId eId, Functor&& func);
+		/** Register a loose listener for the events of a single component.
+		 *
+		 * \tparam Event The event to listen for, must have a Component member.
+		 * \param cId The ID of the component to listen for.
+		 * \param func The functor to call when the event is emitted.
+		 * \returns The ID of the registered listener, for unregisterEvent(ListenerId).
+		 * \sa registerScopedEvent(EntityId, Functor&&)
+		 */
+		template<typename Event, typename Functor>
+		ListenerId registerScopedEvent(ComponentId cId, Functor&& func);
+		/** Register a scoped listener for the events of a single entity, owned by a component.
+		 *
+		 * Like component-based listeners, the listener is unregistered along
+		 * with the other events of its owner when the owner is destroyed.
+		 *
+		 * \tparam Event The event to listen for, must have an Entity member.
+		 * \param owner The ID of the component that owns the listener.
+		 * \param eId The ID of the entity to listen for.
+		 * \param func The functor to call when the event is emitted.
+		 * \returns The ID of the registered listener, for unregisterEvent(ListenerId).
+		 * \sa unregisterAllEvents(ComponentId)
+		 */
+		template<typename Event, typename Functor>
+		ListenerId registerScopedEvent(ComponentId owner, EntityId eId, Functor&& func);
+		/** Register a scoped listener for the events of a single component, owned by a component.
+		 *
+		 * \tparam Event The event to listen for, must have a Component member.
+		 * \param owner The ID of the component that owns the listener.
+		 * \param cId The ID of the component to listen for.
+		 * \param func The functor to call when the event is emitted.
+		 * \returns The ID of the registered listener, for unregisterEvent(ListenerId).
+		 * \sa registerScopedEvent(ComponentId, EntityId, Functor&&)
+		 */
+		template<typename Event, typename Functor>
+		ListenerId registerScopedEvent(ComponentId owner, ComponentId cId, Functor&& func);
 		/** Unregisters all events attached to the given component.
 		 *
 		 * \param cId The ID of the component to unregister from.
+		 * \note Only the event types the component is registered to are touched.
 		 */
 		void unregisterAllEvents(ComponentId cId);
 		/** Unregister an event from a component.
@@ -73,8 +207,8 @@ namespace Kunlaboro
 		 * \tparam Event The event to unregister.
 		 * \param cId The ID of the component to unregister from.
 		 *
-		 * \note This function is O(n) on number of listeners registered
-		 *       of the given event type.
+		 * \note Finding the listener is O(n) on number of event types
+		 *       the component is registered to, removing it is O(1).
 		 */
 		template<typename Event>
 		void unregisterEvent(ComponentId cId);
@@ -83,14 +217,18 @@ namespace Kunlaboro
 		 * \tparam Event The event to unregister.
 		 * \param id The ID of the loose listener to unregister.
 		 *
-		 * \note This function is O(n) on number of listeners registered
-		 *       of the given event type.
+		 * \note This function is O(1), IDs that have already been
+		 *       unregistered are ignored.
 		 */
 		template<typename Event>
 		void unregisterEvent(ListenerId id);
 		/** Emits an already created copy of the given event.
+		 *
+		 * Listeners can be registered and unregistered from inside of a
+		 * listener, those changes are applied once the emit is done.
 		 *
 		 * \param ev The pre-created event and data to emit.
+		 * \note Listeners are not called in any particular order.
 		 */
 		template<typename Event>
 		void emitEvent(const Event& ev) const;
@@ -101,21 +239,271 @@ namespace Kunlaboro
 		 */
 		template<typename Event, typename... Args>
 		void emitEvent(Args... args) const;
+		/** Checks if anything is listening for the given event.
+		 *
+		 * Useful for skipping the work of creating events that nothing
+		 * would receive.
+		 *
+		 * \tparam Event The event type to check.
+		 */
+		template<typename Event>
+		bool hasListeners() const;
+
+		/** Sets the job queue to deliver asynchronous events on.
+		 *
+		 * \param queue The job queue to use, or nullptr to only deliver on drain().
+		 */
+		void setJobQueue(detail::JobQueue* queue);
+		/** Waits until all asynchronously emitted events have been delivered.
+		 *
+		 * Events that are still queued when there's no job queue to
+		 * deliver them are delivered on the calling thread.
+		 *
+		 * \note Must not be called from inside an asynchronous listener.
+		 */
+		void drain();
 
 	private:
 		enum
 		{
 			sComponentEvent = 1,
-			sLooseEvent = 2
+			sLooseEvent = 2,
+			/// Marks a listener that was unregistered during an emit.
+			sRemovedEvent = 3,
+
+			/// The number of asynchronous events that can be queued per event type.
+			sAsyncCapacity = 1024
+		};
+
+		/// The number of low bits of a ListenerId that hold the slot index.
+		static constexpr unsigned sSlotBits = 32;
+		static constexpr ListenerId sSlotMask = (ListenerId(1) << sSlotBits) - 1;
+		/// Flags a slot index as pointing into ListenerList::Added.
+		static constexpr std::size_t sAddedIndex = ~(~std::size_t(0) >> 1);
+		/// Flags a slot index as pointing into BaseAsyncEvents::Listeners.
+		static constexpr std::size_t sAsyncIndex = sAddedIndex >> 1;
+
+		/** Type-erased storage for a single listener.
+		 *
+		 * Small functors are stored inline, so registering them doesn't
+		 * allocate, larger ones are moved onto the heap.
+		 */
+		struct Listener
+		{
+			enum
+			{
+				/// The largest functor that can be stored without allocating.
+				sInlineSize = sizeof(void*) * 3
+			};
+
+			Listener();
+			Listener(const Listener&) = delete;
+			Listener(Listener&& move) = default;
+
+			Listener& operator=(const Listener&) = delete;
+			Listener& operator=(Listener&& move) = default;
+
+			/** Stores the functor to call for the listener.
+			 *
+			 * \tparam Event The event type that the functor receives.
+			 */
+			template<typename Event, typename Functor>
+			void assign(Functor&& func);
+			/// Calls the stored functor, the event must match the one given to assign().
+			template<typename Event>
+			inline void invoke(const Event& ev) const { mInvoke(mFunctor, &ev); }
+
+		private:
+			typedef detail::FunctorStorage<sInlineSize> Storage;
+			typedef void(*InvokeFunc)(const Storage& storage, const void* ev);
+
+			template<typename T, typename Event>
+			static void invokeFunctor(const Storage& storage, const void* ev);
+
+			InvokeFunc mInvoke;
+			Storage mFunctor;
+		};
+		/// Identifies the owner of a listener.
+		struct ListenerInfo
+		{
+			/// The type of the listener, Component, Loose, or Removed.
+			std::uint8_t Type;
+			/// The component that registered the listener, or the component a scoped listener is for.
+			ComponentId Component;
+			/// The entity a scoped listener is for.
+			EntityId Entity;
+			/// The ID of the slot that locates the listener.
+			ListenerId ID;
+		};
+		struct ListenerList;
+		struct ScopedListeners;
+		/// Locates a listener in its list.
+		struct ListenerSlot
+		{
+			/// The position of the listener, positions in Added are flagged with sAddedIndex.
+			std::size_t Index;
+			/// Incremented whenever the slot is freed, to invalidate old IDs.
+			std::uint32_t Generation;
+			/// The scoped bucket holding the listener, or nullptr.
+			ListenerList* Bucket;
+		};
+		/** The asynchronous listeners of an event type, and the events queued for them.
+		 *
+		 * Only a single thread at a time is allowed to deliver events, that
+		 * thread is the one which set Delivering.
+		 */
+		struct BaseAsyncEvents
+		{
+			BaseAsyncEvents()
+				: Pending(0)
+				, Jobs(0)
+				, Delivering(false)
+			{ }
+			virtual ~BaseAsyncEvents() = default;
+
+			/// Calls the listeners for every queued event.
+			virtual void deliver() = 0;
+
+			std::vector<Listener> Listeners;
+			/// The IDs of the listeners, in the same order.
+			std::vector<ListenerId> IDs;
+			/// The number of queued events that haven't been delivered yet.
+			std::atomic<std::size_t> Pending;
+			/// The number of delivery jobs that haven't finished yet.
+			std::atomic<std::uint32_t> Jobs;
+			std::atomic<bool> Delivering;
+		};
+		template<typename Event>
+		struct AsyncEvents : public BaseAsyncEvents
+		{
+			AsyncEvents()
+				: Queue(sAsyncCapacity)
+			{ }
+
+			void deliver() override;
+
+			detail::MPSCQueue<Event> Queue;
+		};
+
+		/// All the listeners of a single event type.
+		struct ListenerList
+		{
+			ListenerList()
+				: Owner(nullptr)
+				, Emitting(0)
+				, Removed(0)
+			{ }
+
+			/// The listeners, called in a single linear pass on emit.
+			std::vector<Listener> Listeners;
+			/// The owners of the listeners, kept apart to keep the emit loop tight.
+			std::vector<ListenerInfo> Info;
+			/// Listeners registered while the event was being emitted.
+			std::vector<Listener> Added;
+			/// The owners of the listeners in Added.
+			std::vector<ListenerInfo> AddedInfo;
+			/// The asynchronous listeners, only exists if any have been registered.
+			std::unique_ptr<BaseAsyncEvents> Async;
+			/// The scoped listeners, only exists if any have been registered.
+			std::unique_ptr<ScopedListeners> Scoped;
+			/// The list that a scoped bucket belongs to, which holds the slots.
+			ListenerList* Owner;
+			/// The slots of the listeners, indexed by ListenerId.
+			std::vector<ListenerSlot> Slots;
+			/// Slots that can be reused.
+			std::vector<std::uint32_t> FreeSlots;
+			/// The number of emits currently running for the event.
+			std::uint32_t Emitting;
+			/// The number of unregistered listeners still waiting to be cleaned out.
+			std::uint32_t Removed;
+		};
+
+		/// Listeners that only receive the events of a single entity or component.
+		struct ScopedListeners
+		{
+			std::unordered_map<EntityId, ListenerList> Entities;
+			std::unordered_map<ComponentId, ListenerList> Components;
+		};
+
+		/** Keeps the listeners of an event stable while it's being emitted.
+		 *
+		 * Any changes made to the listeners while an emit is running are
+		 * deferred until the outermost emit of the event is done.
+		 */
+		struct EmitScope
+		{
+			EmitScope(const ListenerList& list);
+			EmitScope(const EmitScope&) = delete;
+			~EmitScope();
+
+			EmitScope& operator=(const EmitScope&) = delete;
+
+			ListenerList& List;
 		};
 
 		EventSystem(EntitySystem* es);
 
 		friend class EntitySystem;
 
+		/// Gets the listener list of the given event family, creating it if needed.
+		ListenerList& getEvents(std::size_t family);
+		/// Gets the listener list of the given event family, or nullptr if there is none.
+		inline const ListenerList* getEvents(std::size_t family) const
+		{
+			return family < mEvents.size() ? &mEvents[family] : nullptr;
+		}
+		/// Adds a listener to the list, or defers it if the list is being emitted.
+		template<typename Event, typename Functor>
+		void addListener(ListenerList& list, const ListenerInfo& info, Functor&& func);
+		template<typename Event, typename Functor>
+		ListenerId addScopedListener(ListenerList& list, ListenerList& bucket, ListenerInfo info, Functor&& func);
+		/// Calls all the listeners in the list.
+		template<typename Event>
+		void emitList(const ListenerList& list, const Event& ev) const;
+		/// Calls the listeners in the bucket matching the event, if the event has the right key.
+		template<typename Key, typename Event>
+		void emitScoped(const std::unordered_map<Key, ListenerList>& buckets, const Event& ev, std::true_type) const;
+		template<typename Key, typename Event>
+		inline void emitScoped(const std::unordered_map<Key, ListenerList>&, const Event&, std::false_type) const { }
+		/// Removes the listener at the given position in the list.
+		static void removeListener(ListenerList& list, std::size_t index);
+		/// Removes the listener at the given position in ListenerList::Added.
+		static void removeAdded(ListenerList& list, std::size_t index);
+		/// Points the slot of a listener at its current position.
+		static void relink(ListenerList& list, std::size_t index, bool added);
+		static ListenerId allocateSlot(ListenerList& list);
+		/// Removes the listener in the given slot, ignoring IDs that are no longer valid.
+		void removeSlottedListener(ListenerList& list, ListenerId id);
+
+		template<typename Event>
+		void emitAsync(const ListenerList& list, const Event& ev) const;
+		/// Waits until the calling thread is the one delivering the events.
+		static void lockAsync(BaseAsyncEvents& async);
+		/// Stops delivering the events, handing any that are left to a job.
+		void unlockAsync(BaseAsyncEvents& async) const;
+		/// Submits a delivery job, unless the events are already being delivered.
+		void scheduleAsync(BaseAsyncEvents& async) const;
+		/// Delivers all queued events, the calling thread must be delivering.
+		static void runAsync(BaseAsyncEvents& async);
+		static void applyDeferred(ListenerList& list);
+
 		EntitySystem* mES;
 
-		std::unordered_map<std::type_index, std::vector<BaseEvent*>> mEvents;
+		/// The listener lists, indexed by EventFamily, references stay valid as it grows.
+		std::deque<ListenerList> mEvents;
+		/// A listener registered by a component.
+		struct ComponentEvent
+		{
+			/// The event family of the listener.
+			std::size_t Family;
+			/// The slot of the listener.
+			ListenerId ID;
+		};
+		/// The listeners each component has registered, for quick teardown.
+		std::unordered_map<ComponentId, std::vector<ComponentEvent>> mComponentEvents;
+		/// The event types that have asynchronous listeners.
+		std::vector<BaseAsyncEvents*> mAsyncEvents;
+		detail::JobQueue* mJobQueue;
 	};
 
 }
@@ -3,107 +3,139 @@
 #include "EventSystem.hpp"
 
 #include <algorithm>
+#include <new>
+#include <thread>
 #include <type_traits>
+#include <utility>
 
 namespace Kunlaboro
 {
 
-	namespace detail
+	template<typename Event, typename Functor>
+	void EventSystem::registerEvent(ComponentId cId, Functor&& func)
 	{
+		const auto family = EventFamily<Event>::getFamily();
+		auto& list = getEvents(family);
 
-		template<typename Event>
-		struct EventType
-		{
-			std::function<void(const Event&)> Func;
-		};
+		const auto id = allocateSlot(list);
+		addListener<Event>(list, ListenerInfo{ sComponentEvent, cId, EntityId::Invalid(), id }, std::forward<Functor>(func));
+		mComponentEvents[cId].push_back(ComponentEvent{ family, id });
+	}
+	template<typename Event, typename Functor>
+	EventSystem::ListenerId EventSystem::registerEvent(Functor&& func)
+	{
+		auto& list = getEvents(EventFamily<Event>::getFamily());
 
-		struct BaseComponentEvent : public EventSystem::BaseEvent
-		{
-			ComponentId Component;
-		};
-		template<typename Event>
-		struct ComponentEvent : public BaseComponentEvent, public EventType<Event>
-		{ };
+		const auto id = allocateSlot(list);
+		addListener<Event>(list, ListenerInfo{ sLooseEvent, ComponentId::Invalid(), EntityId::Invalid(), id }, std::forward<Functor>(func));
+		return id;
+	}
+	template<typename Event, typename Functor>
+	EventSystem::ListenerId EventSystem::registerAsyncEvent(Functor&& func)
+	{
+		static_assert(std::is_copy_constructible<Event>::value, "Asynchronous events must be copy constructible.");
+		static_assert(!detail::IsBorrowedEvent<Event>::value, "Events that borrow their data can't be delivered asynchronously.");
 
-		struct BaseLooseEvent : public EventSystem::BaseEvent
+		auto& list = getEvents(EventFamily<Event>::getFamily());
+		if (!list.Async)
 		{
-			std::size_t ID;
-		};
-		template<typename Event>
-		struct LooseEvent : public BaseLooseEvent, public EventType<Event>
-		{ };
+			list.Async.reset(new AsyncEvents<Event>());
+			mAsyncEvents.push_back(list.Async.get());
+		}
 
-	}
+		BaseAsyncEvents& async = *list.Async;
+		const auto id = allocateSlot(list);
 
+		lockAsync(async);
+		async.Listeners.emplace_back();
+		async.Listeners.back().assign<Event>(std::forward<Functor>(func));
+		async.IDs.push_back(id);
+		list.Slots[id & sSlotMask].Index = (async.Listeners.size() - 1) | sAsyncIndex;
+		unlockAsync(async);
+
+		return id;
+	}
 	template<typename Event, typename Functor>
-	void EventSystem::registerEvent(ComponentId cId, Functor&& func)
+	EventSystem::ListenerId EventSystem::registerScopedEvent(EntityId eId, Functor&& func)
 	{
-		auto& list = mEvents[typeid(Event)];
+		static_assert(detail::EventKey<EntityId, Event>::value, "Only events with an Entity member can be scoped by entity.");
 
-		auto* ev = new detail::ComponentEvent<Event>();
-		ev->Component = cId;
-		ev->Func = std::move(func);
-		ev->Type = sComponentEvent;
+		ListenerList& list = getEvents(EventFamily<Event>::getFamily());
+		if (!list.Scoped)
+			list.Scoped.reset(new ScopedListeners());
 
-		list.push_back(ev);
+		return addScopedListener<Event>(list, list.Scoped->Entities[eId], ListenerInfo{ sLooseEvent, ComponentId::Invalid(), eId, 0 }, std::forward<Functor>(func));
 	}
 	template<typename Event, typename Functor>
-	EventSystem::ListenerId EventSystem::registerEvent(Functor&& func)
+	EventSystem::ListenerId EventSystem::registerScopedEvent(ComponentId cId, Functor&& func)
 	{
-		auto& list = mEvents[typeid(Event)];
+		static_assert(detail::EventKey<ComponentId, Event>::value, "Only events with a Component member can be scoped by component.");
 
-		auto* ev = new detail::LooseEvent<Event>();
-		ev->Func = std::move(func);
-		ev->ID = list.size();
-		ev->Type = sLooseEvent;
+		ListenerList& list = getEvents(EventFamily<Event>::getFamily());
+		if (!list.Scoped)
+			list.Scoped.reset(new ScopedListeners());
 
-		list.push_back(ev);
-		return ev->ID;
+		return addScopedListener<Event>(list, list.Scoped->Components[cId], ListenerInfo{ sLooseEvent, cId, EntityId::Invalid(), 0 }, std::forward<Functor>(func));
+	}
+	template<typename Event, typename Functor>
+	EventSystem::ListenerId EventSystem::registerScopedEvent(ComponentId owner, EntityId eId, Functor&& func)
+	{
+		const auto id = registerScopedEvent<Event>(eId, std::forward<Functor>(func));
+		mComponentEvents[owner].push_back(ComponentEvent{ EventFamily<Event>::getFamily(), id });
+		return id;
+	}
+	template<typename Event, typename Functor>
+	EventSystem::ListenerId EventSystem::registerScopedEvent(ComponentId owner, ComponentId cId, Functor&& func)
+	{
+		const auto id = registerScopedEvent<Event>(cId, std::forward<Functor>(func));
+		mComponentEvents[owner].push_back(ComponentEvent{ EventFamily<Event>::getFamily(), id });
+		return id;
 	}
 	template<typename Event>
 	void EventSystem::unregisterEvent(ComponentId cId)
 	{
-		auto& list = mEvents[typeid(Event)];
+		const auto family = EventFamily<Event>::getFamily();
 
-		auto it = std::find_if(list.cbegin(), list.cend(), [cId](const BaseEvent* ev) {
-			return ev->Type == sComponentEvent && static_cast<const detail::BaseComponentEvent*>(ev)->Component == cId;
-		});
+		auto events = mComponentEvents.find(cId);
+		if (events == mComponentEvents.end())
+			return;
 
-		if (it != list.cend())
-		{
-			delete *it;
-			list.erase(it);
-		}
+		auto& registered = events->second;
+		auto entry = std::find_if(registered.begin(), registered.end(), [family](const ComponentEvent& ev) { return ev.Family == family; });
+		if (entry == registered.end())
+			return;
+
+		removeSlottedListener(mEvents[family], entry->ID);
+
+		*entry = registered.back();
+		registered.pop_back();
+		if (registered.empty())
+			mComponentEvents.erase(events);
 	}
 	template<typename Event>
 	void EventSystem::unregisterEvent(ListenerId id)
 	{
-		auto& list = mEvents[typeid(Event)];
-
-		auto it = std::find_if(list.cbegin(), list.cend(), [id](const BaseEvent* ev) {
-			return ev->Type == sLooseEvent && static_cast<const detail::BaseLooseEvent*>(ev)->ID == id;
-		});
+		const auto family = EventFamily<Event>::getFamily();
+		if (family >= mEvents.size())
+			return;
 
-		if (it != list.cend())
-		{
-			delete *it;
-			list.erase(it);
-		}
+		removeSlottedListener(mEvents[family], id);
 	}
 	template<typename Event>
 	void EventSystem::emitEvent(const Event& toSend) const
 	{
-		if (mEvents.count(typeid(Event)) == 0)
+		const auto* list = getEvents(EventFamily<Event>::getFamily());
+		if (!list)
 			return;
 
-		const auto& list = mEvents.at(typeid(Event));
-
-		for (auto& ev : list)
+		if (list->Async)
+			emitAsync(*list, toSend);
+		if (!list->Listeners.empty())
+			emitList(*list, toSend);
+		if (list->Scoped)
 		{
-			if (ev->Type == sLooseEvent)
-				static_cast<const detail::LooseEvent<Event>*>(ev)->Func(toSend);
-			else
-				static_cast<const detail::ComponentEvent<Event>*>(ev)->Func(toSend);
+			emitScoped(list->Scoped->Entities, toSend, detail::EventKey<EntityId, Event>());
+			emitScoped(list->Scoped->Components, toSend, detail::EventKey<ComponentId, Event>());
 		}
 	}
 	template<typename Event, typename... Args>
@@ -114,5 +146,113 @@ namespace Kunlaboro
 		Event toSend{ std::forward<Args>(args)... };
 		emitEvent(toSend);
 	}
+	template<typename Event>
+	bool EventSystem::hasListeners() const
+	{
+		const auto* list = getEvents(EventFamily<Event>::getFamily());
+		return list && (!list->Listeners.empty()
+			|| (list->Async && !list->Async->Listeners.empty())
+			|| (list->Scoped && (!list->Scoped->Entities.empty() || !list->Scoped->Components.empty())));
+	}
+
+	template<typename Event, typename Functor>
+	void EventSystem::addListener(ListenerList& list, const ListenerInfo& info, Functor&& func)
+	{
+		if (list.Emitting > 0)
+		{
+			list.Added.emplace_back();
+			list.Added.back().assign<Event>(std::forward<Functor>(func));
+			list.AddedInfo.push_back(info);
+			relink(list, list.Added.size() - 1, true);
+			return;
+		}
+
+		list.Listeners.emplace_back();
+		list.Listeners.back().assign<Event>(std::forward<Functor>(func));
+		list.Info.push_back(info);
+		relink(list, list.Listeners.size() - 1, false);
+	}
+
+	template<typename Event, typename Functor>
+	EventSystem::ListenerId EventSystem::addScopedListener(ListenerList& list, ListenerList& bucket, ListenerInfo info, Functor&& func)
+	{
+		bucket.Owner = &list;
+
+		info.ID = allocateSlot(list);
+		list.Slots[info.ID & sSlotMask].Bucket = &bucket;
+		addListener<Event>(bucket, info, std::forward<Functor>(func));
+
+		return info.ID;
+	}
+	template<typename Event>
+	void EventSystem::emitList(const ListenerList& list, const Event& ev) const
+	{
+		EmitScope scope(list);
+
+		const auto* listeners = list.Listeners.data();
+		const auto* info = list.Info.data();
+		const auto count = list.Listeners.size();
+		for (std::size_t i = 0; i < count; ++i)
+			if (info[i].Type != sRemovedEvent)
+				listeners[i].invoke(ev);
+	}
+	template<typename Key, typename Event>
+	void EventSystem::emitScoped(const std::unordered_map<Key, ListenerList>& buckets, const Event& ev, std::true_type) const
+	{
+		if (buckets.empty())
+			return;
+
+		auto found = buckets.find(detail::EventKey<Key, Event>::get(ev));
+		if (found != buckets.end() && !found->second.Listeners.empty())
+			emitList(found->second, ev);
+	}
+	template<typename Event>
+	void EventSystem::emitAsync(const ListenerList& list, const Event& ev) const
+	{
+		auto& async = static_cast<AsyncEvents<Event>&>(*list.Async);
+		if (async.Listeners.empty())
+			return;
+
+		// Counted before pushing, so a delivery can never take the count below zero
+		async.Pending.fetch_add(1);
+		while (!async.Queue.push(ev))
+		{
+			// Full, help out with a single pass of delivery unless it's already in progress,
+			// looping until nothing is pending would wait on this very event
+			if (!async.Delivering.exchange(true, std::memory_order_acq_rel))
+			{
+				async.deliver();
+				async.Delivering.store(false);
+			}
+			else
+				std::this_thread::yield();
+		}
+
+		scheduleAsync(async);
+	}
+	template<typename Event>
+	void EventSystem::AsyncEvents<Event>::deliver()
+	{
+		while (Queue.pop([this](Event& ev) {
+			for (auto& listener : Listeners)
+				listener.invoke(ev);
+		}))
+			Pending.fetch_sub(1);
+	}
+
+	template<typename Event, typename Functor>
+	void EventSystem::Listener::assign(Functor&& func)
+	{
+		typedef typename std::decay<Functor>::type FunctorType;
+
+		mFunctor.template emplace<FunctorType>(std::forward<Functor>(func));
+		mInvoke = &invokeFunctor<FunctorType, Event>;
+	}
+
+	template<typename T, typename Event>
+	void EventSystem::Listener::invokeFunctor(const Storage& storage, const void* ev)
+	{
+		storage.template get<T>()(*static_cast<const Event*>(ev));
+	}
 
-}
\ No newline at end of file
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
 
 namespace Kunlaboro
 {
@@ -97,6 +98,7 @@ namespace Kunlaboro
 
 	private:
 		friend class EntitySystem;
+		friend struct std::hash<BaseEntityId>;
 
 		idType mId;
 	};
@@ -211,6 +213,7 @@ namespace Kunlaboro
 
 	private:
 		friend class EntitySystem;
+		friend struct std::hash<BaseComponentId>;
 
 		idType mId;
 };
@@ -249,3 +252,24 @@ namespace Kunlaboro
 	static_assert(sizeof(ComponentId) == sizeof(ComponentId::IdType), "ComponentId has extra padding, this might break things");
 
 }
+
+namespace std
+{
+	template<typename idType, typename indexType, uint8_t IndexBits, typename generationType, uint8_t GenerationBits>
+	struct hash<::Kunlaboro::BaseEntityId<idType, indexType, IndexBits, generationType, GenerationBits>>
+	{
+		size_t operator()(const ::Kunlaboro::BaseEntityId<idType, indexType, IndexBits, generationType, GenerationBits>& id) const noexcept
+		{
+			return hash<idType>()(id.mId);
+		}
+	};
+
+	template<typename idType, typename indexType, uint8_t IndexBits, typename generationType, uint8_t GenerationBits, typename familyType, uint8_t FamilyBits>
+	struct hash<::Kunlaboro::BaseComponentId<idType, indexType, IndexBits, generationType, GenerationBits, familyType, FamilyBits>>
+	{
+		size_t operator()(const ::Kunlaboro::BaseComponentId<idType, indexType, IndexBits, generationType, GenerationBits, familyType, FamilyBits>& id) const noexcept
+		{
+			return hash<idType>()(id.mId);
+		}
+	};
+}
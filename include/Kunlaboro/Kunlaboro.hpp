@@ -6,6 +6,7 @@
 #include "EventSystem.inl"
 #include "Message.inl"
 #include "MessageSystem.inl"
+#include "System.inl"
 #include "Views.inl"
 
 /** \mainpage
@@ -1,7 +1,8 @@
 #pragma once
 
 #include "Component.hpp"
-#include <functional>
+
+#include <utility>
 
 namespace Kunlaboro
 {
@@ -13,10 +14,10 @@ namespace Kunlaboro
 	 */
 	class MessagingComponent : public Component
 	{
-	public:
-		MessagingComponent();
-
 	protected:
+		/// Calls addedToEntity() for the entity the component was attached to.
+		void onAttached(EntityId eid) override;
+
 		/** This function is called every time the component is added to an entity.
 		 *
 		 * In here you want to request the messages you want to receive during the
@@ -67,6 +68,22 @@ namespace Kunlaboro
 		 */
 		template<typename... Args, typename Obj>
 		void requestMessage(MessageId id, void (Obj::*func)(Args...), float prio = 0);
+		/** Helper method for requesting against a member method known at compile time.
+		 *
+		 * The method is bound into the call itself, so the request only
+		 * stores the component pointer and the call can be inlined.
+		 *
+		 * \code{.cpp}
+		 * requestMessage<decltype(&Example::Tick), &Example::Tick>(id);
+		 * \endcode
+		 *
+		 * \param id The ID of the message to receive.
+		 * \param prio The priority of the request, in ascending order.
+		 * \tparam Method The type of the member method.
+		 * \tparam Func The member method to receive the message.
+		 */
+		template<typename Method, Method Func>
+		void requestMessage(MessageId id, float prio = 0);
 		/** Unrequest the message with the given ID.
 		 */
 		void unrequestMessage(MessageId id);
@@ -122,6 +139,18 @@ namespace Kunlaboro
 		 */
 		template<typename... Args, typename Obj>
 		void requestMessageId(const char* const id, void (Obj::*func)(Args...), float prio = 0);
+		/** Helper method to request a message from an unhashed string.
+		 *
+		 * \param id The ID string of the message to request.
+		 * \param prio The priority of the request, in ascending order.
+		 * \tparam Method The type of the member method.
+		 * \tparam Func The member method to receive the call.
+		 *
+		 * \note Even though these functions hash at compile time,
+		 *       using pre-hashed messages will be faster.
+		 */
+		template<typename Method, Method Func>
+		void requestMessageId(const char* const id, float prio = 0);
 		/** Helper method to unrequest a message from an unhashed string.
 		 *
 		 * \param id The ID string of the message to unrequest.
@@ -172,6 +201,23 @@ namespace Kunlaboro
 		 */
 		template<typename... Args>
 		void sendMessageIdTo(const char* const id, ComponentId comp, Args... args) const;
+
+	private:
+		/// Calls a member method given at runtime, small enough to be stored without allocating.
+		template<typename Obj, typename... Args>
+		struct MethodCall
+		{
+			Obj* Object;
+			void (Obj::*Method)(Args...);
+
+			void operator()(Args... args) const { (Object->*Method)(std::forward<Args>(args)...); }
+		};
+		/// Calls a member method given at compile time, only storing the object.
+		template<typename Method, Method Func>
+		struct MethodStub;
+
+		template<typename... Args, typename Obj, typename Functor>
+		void requestMethod(MessageId id, Functor&& func, void (Obj::*)(Args...), float prio);
 	};
 
 }
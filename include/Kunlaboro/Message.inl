@@ -8,7 +8,15 @@
 namespace Kunlaboro
 {
 
+	template<typename Obj, typename... Args, void (Obj::*Func)(Args...)>
+	struct MessagingComponent::MethodStub<void (Obj::*)(Args...), Func>
+	{
+		typedef Obj ObjectType;
+
+		Obj* Object;
 
+		void operator()(Args... args) const { (Object->*Func)(std::forward<Args>(args)...); }
+	};
 
 	template<typename... Args, typename Functor>
 	void MessagingComponent::requestMessage(MessageId id, Functor&& func, float prio)
@@ -18,7 +26,19 @@ namespace Kunlaboro
 	template<typename... Args, typename Obj>
 	void MessagingComponent::requestMessage(MessageId id, void (Obj::*func)(Args...), float prio)
 	{
-		getEntitySystem()->getMessageSystem().requestMessage<Args...>(getId(), id, std::bind1st(std::mem_fn(func), static_cast<Obj*>(this)), prio);
+		getEntitySystem()->getMessageSystem().requestMessage<Args...>(getId(), id, MethodCall<Obj, Args...>{ static_cast<Obj*>(this), func }, prio);
+	}
+	template<typename Method, Method Func>
+	void MessagingComponent::requestMessage(MessageId id, float prio)
+	{
+		typedef MethodStub<Method, Func> Stub;
+
+		requestMethod(id, Stub{ static_cast<typename Stub::ObjectType*>(this) }, Func, prio);
+	}
+	template<typename... Args, typename Obj, typename Functor>
+	void MessagingComponent::requestMethod(MessageId id, Functor&& func, void (Obj::*)(Args...), float prio)
+	{
+		getEntitySystem()->getMessageSystem().requestMessage<Args...>(getId(), id, std::forward<Functor>(func), prio);
 	}
 
 	template<typename... Args>
@@ -49,6 +69,11 @@ namespace Kunlaboro
 	{
 		requestMessage(MessageSystem::hash(id), func, prio);
 	}
+	template<typename Method, Method Func>
+	void MessagingComponent::requestMessageId(const char* const id, float prio)
+	{
+		requestMessage<Method, Func>(MessageSystem::hash(id), prio);
+	}
 
 	template<typename... Args>
 	void MessagingComponent::sendMessageId(const char* const id, Args... args) const
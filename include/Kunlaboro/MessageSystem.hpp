@@ -3,9 +3,17 @@
 #include "ID.hpp"
 #include "Message.hpp"
 #include "detail/Delegate.hpp"
+#include "detail/FunctorStorage.hpp"
+#include "detail/MPSCQueue.hpp"
 
-#include <unordered_map>
 #include <deque>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace Kunlaboro
 {
@@ -59,14 +67,69 @@ namespace Kunlaboro
 	}
 
 	class EntitySystem;
+	namespace detail { class JobQueue; }
+
+	struct BaseChannelFamily
+	{
+	protected:
+		static std::size_t sFamilyCounter;
+	};
+
+	/** Base for compile-time message channels.
+	 *
+	 * A channel is a message that is identified by its type instead of by
+	 * a hashed name, so sending it requires neither hashing nor a lookup.
+	 * The arguments are part of the type, so passing the wrong ones is
+	 * a compile-time error.
+	 *
+	 * Simple example of a tick channel;
+	 * \code{.cpp}
+	 * struct Tick : public Kunlaboro::Channel<float> { };
+	 *
+	 * messageSystem.request<Tick>(componentId, [](float dt) { });
+	 * messageSystem.send<Tick>(0.016f);
+	 * \endcode
+	 *
+	 * \tparam Args The arguments of the channel.
+	 */
+	template<typename... Args>
+	struct Channel
+	{
+	};
+
+	/** Helper class for getting the dense index of a channel.
+	 *
+	 * \tparam T The channel type.
+	 */
+	template<typename T>
+	class ChannelFamily : BaseChannelFamily
+	{
+	public:
+		/** Retrieves the index of the requested channel.
+		 *
+		 * \note Like component families, this is backed by a global counter.
+		 */
+		static std::size_t getFamily()
+		{
+			static std::size_t sFamily = sFamilyCounter++;
+			return sFamily;
+		}
+	};
 
 	/** Message passing system
+	 *
+	 * Messages can either be identified by hashed strings, or by compile-time
+	 * channel types. Channels skip the hashing and lookups, and should be
+	 * preferred on hot paths.
 	 *
 	 * \note Uses hashed strings as message IDs
 	 * \todo Do collision testing on debug builds
 	 */
 	class MessageSystem
 	{
+		template<typename... Args>
+		struct Mailbox;
+
 	public:
 		/** The locality of the message.
 		 *
@@ -243,6 +306,275 @@ namespace Kunlaboro
 		*/
 		void unrequestAllMessages(EntityId eId);
 
+		/** Request messages sent on the given channel.
+		 *
+		 * \tparam T The channel to request.
+		 * \param cId The ID of the component to receive the messages.
+		 * \param func The functor to call, must accept the channel arguments.
+		 * \param prio The priority of the request, in ascending order.
+		 */
+		template<typename T, typename Functor>
+		void request(ComponentId cId, Functor&& func, float prio = 0);
+		/** Remove a request for the given channel.
+		 *
+		 * \tparam T The channel that was requested.
+		 * \param cId The ID of the component that made the request.
+		 */
+		template<typename T>
+		void unrequest(ComponentId cId);
+		/** Change the priority of a request for the given channel.
+		 *
+		 * \tparam T The channel that was requested.
+		 * \param cId The ID of the component that made the request.
+		 * \param prio The new priority of the request.
+		 */
+		template<typename T>
+		void reprioritize(ComponentId cId, float prio);
+
+		/** Send a global message on the given channel.
+		 *
+		 * \tparam T The channel to send on.
+		 * \param args The arguments of the message, must match the channel.
+		 */
+		template<typename T, typename... Args>
+		void send(Args&&... args) const;
+		/** Send a local message on the given channel to a component.
+		 *
+		 * \tparam T The channel to send on.
+		 * \param cId The ID of the component to receive the message.
+		 * \param args The arguments of the message, must match the channel.
+		 */
+		template<typename T, typename... Args>
+		void sendTo(ComponentId cId, Args&&... args) const;
+		/** Send a local message on the given channel to all components of an entity.
+		 *
+		 * \tparam T The channel to send on.
+		 * \param eId The ID of the entity to receive the message.
+		 * \param args The arguments of the message, must match the channel.
+		 */
+		template<typename T, typename... Args>
+		void sendTo(EntityId eId, Args&&... args) const;
+
+		/** Queue a global message with the given ID, to be delivered on the next flush.
+		 *
+		 * \param mId The ID of the message to post.
+		 * \param args The arguments of the message, these are copied into the queue.
+		 *
+		 * \sa flush()
+		 */
+		template<typename... Args>
+		void postMessage(MessageId mId, Args&&... args);
+		/** Queue a local message with the given ID, to be delivered on the next flush.
+		 *
+		 * \param mId The ID of the message to post.
+		 * \param cId The ID of the component to receive the message.
+		 * \param args The arguments of the message, these are copied into the queue.
+		 *
+		 * \sa flush()
+		 */
+		template<typename... Args>
+		void postMessageTo(MessageId mId, ComponentId cId, Args&&... args);
+		/** Queue a global message on the given channel, to be delivered on the next flush.
+		 *
+		 * \tparam T The channel to post on.
+		 * \param args The arguments of the message, must match the channel.
+		 */
+		template<typename T, typename... Args>
+		void post(Args&&... args);
+		/** Queue a local message on the given channel, to be delivered on the next flush.
+		 *
+		 * \tparam T The channel to post on.
+		 * \param cId The ID of the component to receive the message.
+		 * \param args The arguments of the message, must match the channel.
+		 */
+		template<typename T, typename... Args>
+		void postTo(ComponentId cId, Args&&... args);
+
+		/** Sets if queued messages with the given ID should be coalesced.
+		 *
+		 * When coalescing, posting a message to a receiver that already has
+		 * one queued will replace the arguments of the queued message,
+		 * so only the latest one is delivered.
+		 *
+		 * \param mId The ID of the message.
+		 * \param coalesce Should the queued messages be coalesced.
+		 * \note Coalescing posts are O(1), the queued messages are indexed by receiver.
+		 */
+		void setCoalescing(MessageId mId, bool coalesce);
+		/** Sets if queued messages on the given channel should be coalesced.
+		 *
+		 * \tparam T The channel.
+		 * \param coalesce Should the queued messages be coalesced.
+		 * \sa setCoalescing(MessageId, bool)
+		 */
+		template<typename T>
+		void setCoalescing(bool coalesce);
+
+		/** Sets if the requests for the message with the given ID can be called in parallel.
+		 *
+		 * Global sends of thread-safe messages are spread out over the job
+		 * queue set with setJobQueue(). Requests with a lower priority are
+		 * all finished before any request with a higher priority is started.
+		 *
+		 * \param mId The ID of the message.
+		 * \param threadSafe Can the requests be called in parallel.
+		 * \note Requests of a thread-safe message may only pass messages on
+		 *       through a MailboxHandle, they must not send, post, request,
+		 *       unrequest or reprioritize messages while being called.
+		 *       This is asserted on in debug builds.
+		 * \sa inParallelDispatch()
+		 */
+		void setThreadSafe(MessageId mId, bool threadSafe);
+		/** Sets if the requests on the given channel can be called in parallel.
+		 *
+		 * \tparam T The channel.
+		 * \param threadSafe Can the requests be called in parallel.
+		 * \sa setThreadSafe(MessageId, bool)
+		 */
+		template<typename T>
+		void setThreadSafe(bool threadSafe);
+		/** Sets the job queue to dispatch thread-safe messages on.
+		 *
+		 * \param queue The job queue to use, or nullptr to always dispatch serially.
+		 */
+		void setJobQueue(detail::JobQueue* queue);
+		/** Checks if the calling thread is running the requests of a thread-safe message.
+		 *
+		 * \sa setThreadSafe(MessageId, bool)
+		 */
+		static bool inParallelDispatch();
+
+		/** Handle for mailing a message from any thread.
+		 *
+		 * Mailing through a handle goes straight to the mailbox, without
+		 * looking up the message. Unlike mailMessage() and mail() it's
+		 * therefore safe while the owning thread registers or requests
+		 * other messages.
+		 *
+		 * \tparam Args The arguments of the mailed message.
+		 * \sa createMailbox(MessageId, std::size_t)
+		 */
+		template<typename... Args>
+		class MailboxHandle
+		{
+		public:
+			MailboxHandle()
+				: mMailbox(nullptr)
+			{ }
+
+			/** Mails a global message, can be called from any thread.
+			 *
+			 * \param params The arguments of the message.
+			 * \returns If the message was mailed, false if the mailbox is full or missing.
+			 */
+			template<typename... Params>
+			bool mail(Params&&... params) const;
+			/** Mails a local message, can be called from any thread.
+			 *
+			 * \param cId The ID of the component to receive the message.
+			 * \param params The arguments of the message.
+			 * \returns If the message was mailed, false if the mailbox is full or missing.
+			 */
+			template<typename... Params>
+			bool mailTo(ComponentId cId, Params&&... params) const;
+
+			/// Checks if the handle refers to a mailbox.
+			inline explicit operator bool() const { return mMailbox != nullptr; }
+
+		private:
+			friend class MessageSystem;
+
+			MailboxHandle(Mailbox<Args...>* mailbox)
+				: mMailbox(mailbox)
+			{ }
+
+			Mailbox<Args...>* mMailbox;
+		};
+
+	private:
+		template<typename... Args>
+		static MailboxHandle<typename std::decay<Args>::type...> channelMailbox(const Channel<Args...>*);
+
+	public:
+		/// The mailbox handle type of the given channel.
+		template<typename T>
+		using ChannelMailbox = decltype(channelMailbox(static_cast<const T*>(nullptr)));
+
+		/** Creates a mailbox for the message with the given ID.
+		 *
+		 * A mailbox lets any thread send the message without locking, the
+		 * mailed messages are then delivered by flush() on the owning thread.
+		 *
+		 * \tparam Args The arguments of the message.
+		 * \param mId The ID of the message.
+		 * \param capacity The number of messages the mailbox can hold between flushes.
+		 * \returns A handle to mail the message through, empty if the message isn't registered.
+		 *          Returns the existing mailbox if one has already been created.
+		 * \note Must be called before any thread mails the message.
+		 */
+		template<typename... Args>
+		MailboxHandle<typename std::decay<Args>::type...> createMailbox(MessageId mId, std::size_t capacity);
+		/** Creates a mailbox for the given channel.
+		 *
+		 * \tparam T The channel.
+		 * \param capacity The number of messages the mailbox can hold between flushes.
+		 * \returns A handle to mail the channel through.
+		 * \sa createMailbox(MessageId, std::size_t)
+		 */
+		template<typename T>
+		ChannelMailbox<T> createMailbox(std::size_t capacity = 1024);
+
+		/** Mails a global message with the given ID, can be called from any thread.
+		 *
+		 * \param mId The ID of the message, must have a mailbox.
+		 * \param args The arguments of the message, must match the mailbox.
+		 * \returns If the message was mailed, false if the mailbox is full or missing.
+		 * \note This looks up the message, so no messages may be registered or
+		 *       requested while other threads mail this way. Mail through the
+		 *       MailboxHandle returned by createMailbox() to avoid that.
+		 */
+		template<typename... Args>
+		bool mailMessage(MessageId mId, Args&&... args);
+		/** Mails a local message with the given ID, can be called from any thread.
+		 *
+		 * \param mId The ID of the message, must have a mailbox.
+		 * \param cId The ID of the component to receive the message.
+		 * \param args The arguments of the message, must match the mailbox.
+		 * \returns If the message was mailed, false if the mailbox is full or missing.
+		 * \note Has the same restrictions as mailMessage().
+		 */
+		template<typename... Args>
+		bool mailMessageTo(MessageId mId, ComponentId cId, Args&&... args);
+		/** Mails a global message on the given channel, can be called from any thread.
+		 *
+		 * \tparam T The channel, must have a mailbox.
+		 * \param args The arguments of the message, must match the channel.
+		 * \returns If the message was mailed, false if the mailbox is full or missing.
+		 * \note This looks up the channel, so no channels may be registered or
+		 *       requested while other threads mail this way. Mail through the
+		 *       MailboxHandle returned by createMailbox() to avoid that.
+		 */
+		template<typename T, typename... Args>
+		bool mail(Args&&... args);
+		/** Mails a local message on the given channel, can be called from any thread.
+		 *
+		 * \tparam T The channel, must have a mailbox.
+		 * \param cId The ID of the component to receive the message.
+		 * \param args The arguments of the message, must match the channel.
+		 * \returns If the message was mailed, false if the mailbox is full or missing.
+		 * \note Has the same restrictions as mail().
+		 */
+		template<typename T, typename... Args>
+		bool mailTo(ComponentId cId, Args&&... args);
+
+		/** Delivers all mailed and queued messages.
+		 *
+		 * Mailboxes are drained first, then each message type has its queue
+		 * delivered in one go, in the order the messages were posted.
+		 * Messages posted while flushing are kept for the next flush.
+		 */
+		void flush();
+
 		/** Hash a message string into a MessageId at compile time.
 		 *
 		 * \param msg The c-string to hash
@@ -261,36 +593,61 @@ namespace Kunlaboro
 		}
 
 	private:
+		template<typename T> struct ident { typedef T type; };
+
 		MessageSystem(EntitySystem* es);
 
 		friend class EntitySystem;
 
 		EntitySystem* mES;
 
-		struct BaseMessageCallback
+		/** A single request for a message.
+		 *
+		 * The functor is stored inline when it's small enough, so that all
+		 * the requests for a message can be kept in one contiguous array.
+		 */
+		struct MessageCallback
 		{
-			BaseMessageCallback(ComponentId cId, float p)
-				: Component(cId)
-				, Priority(p)
-			{ }
+			enum
+			{
+				/// The largest functor that can be stored without allocating.
+				sInlineSize = sizeof(void*) * 3
+			};
+
+			MessageCallback(ComponentId cId, float p);
+			MessageCallback(const MessageCallback&) = delete;
+			MessageCallback(MessageCallback&& move) = default;
+
+			MessageCallback& operator=(const MessageCallback&) = delete;
+			MessageCallback& operator=(MessageCallback&& move) = default;
+
+			/** Stores the functor to call for the request.
+			 *
+			 * \tparam Args The arguments of the message.
+			 */
+			template<typename... Args, typename Functor>
+			void assign(Functor&& func);
+			/** Calls the stored functor.
+			 *
+			 * \tparam Args The arguments of the message, must match the ones given to assign().
+			 */
+			template<typename... Args>
+			void invoke(Args&... args) const;
 
 			ComponentId Component;
 			float Priority;
+			/// Set when the request has been removed, but not yet cleaned out.
+			bool Removed;
 
-			inline bool operator<(const BaseMessageCallback& cb) const
-			{
-				return Priority < cb.Priority;
-			}
-		};
-		template<typename... Args>
-		struct MessageCallback : public BaseMessageCallback
-		{
-			MessageCallback(ComponentId cId, float p, detail::Delegate<void(Args...)>&& func)
-				: BaseMessageCallback(cId, p)
-				, Func(func)
-			{ }
+		private:
+			typedef detail::FunctorStorage<sInlineSize> Storage;
+			typedef void(*InvokeFunc)();
+
+			template<typename T, typename... Args>
+			static void invokeFunctor(const Storage& storage, Args&... args);
 
-			detail::Delegate<void(Args...)> Func;
+			InvokeFunc mInvoke;
+			Storage mFunctor;
 		};
 
 
@@ -326,10 +683,10 @@ namespace Kunlaboro
 					f(...);
 			};
 
+		public:
 			template<typename F>
 			using can_call = decltype(can_call_test::template f<F>(0));
 
-		public:
 			/** Checks that the given functor can be called with the message arguments.
 			 */
 			template<typename Functor>
@@ -340,14 +697,205 @@ namespace Kunlaboro
 			{ }
 		};
 
+		struct MessageData;
+
+		/** Storage for messages that have been posted but not yet delivered.
+		 */
+		struct BaseMessageQueue
+		{
+			virtual ~BaseMessageQueue() = default;
+
+			/// Delivers all queued messages, and empties the queue.
+			virtual void flush(const MessageSystem& system, const MessageData& message) = 0;
+		};
+		template<typename... Args>
+		struct MessageQueue : public BaseMessageQueue
+		{
+			typedef std::tuple<Args...> Arguments;
+			/// A queued message, global messages target ComponentId::Invalid().
+			typedef std::pair<ComponentId, Arguments> Entry;
+
+			MessageQueue()
+				: Indexed(0)
+			{ }
+
+			void flush(const MessageSystem& system, const MessageData& message) override;
+			/** Finds the slot in the index for the queued message to a receiver.
+			 *
+			 * \returns The slot, holding the position of the message in Entries
+			 *          plus one, or zero if no message is queued for the receiver.
+			 */
+			std::size_t& findIndex(ComponentId target);
+
+			/// Messages waiting for the next flush.
+			std::vector<Entry> Entries;
+			/// Messages currently being delivered, kept around for its capacity.
+			std::vector<Entry> Flushing;
+			/// Open-addressed index of Entries by receiver, only filled when coalescing.
+			std::vector<std::size_t> Index;
+			/// The number of messages in the index.
+			std::size_t Indexed;
+
+			/// Delivers a single queued message.
+			template<std::size_t... I>
+			static void deliver(const MessageSystem& system, const MessageData& message, Entry& entry, std::index_sequence<I...>);
+		};
+
+		/** Lock-free storage for messages mailed from other threads.
+		 */
+		struct BaseMailbox
+		{
+			virtual ~BaseMailbox() = default;
+
+			/// Delivers the messages that are in the mailbox.
+			virtual void drain(const MessageSystem& system, const MessageData& message) = 0;
+		};
+		template<typename... Args>
+		struct Mailbox : public BaseMailbox
+		{
+			typedef typename MessageQueue<Args...>::Arguments Arguments;
+			typedef typename MessageQueue<Args...>::Entry Entry;
+
+			Mailbox(std::size_t capacity)
+				: Entries(capacity)
+			{ }
+
+			void drain(const MessageSystem& system, const MessageData& message) override;
+
+			detail::MPSCQueue<Entry> Entries;
+		};
+
 		struct MessageData
 		{
+			MessageData()
+				: Locality(Message_Either)
+				, Type(nullptr)
+				, Dispatching(0)
+				, Removed(0)
+				, Dirty(false)
+				, Coalesce(false)
+				, ThreadSafe(false)
+			{ }
+
 			MessageLocality Locality;
 			BaseMessageType* Type;
 
-			std::deque<BaseMessageCallback*> Callbacks;
+			/// The requests for the message, sorted by priority.
+			std::vector<MessageCallback> Callbacks;
+			/// Requests made while the message was being dispatched.
+			std::deque<MessageCallback> Added;
+			/// Index of the live requests by component, entries in Added are flagged with sAddedIndex.
+			std::unordered_map<ComponentId, std::size_t> Receivers;
+			/// The number of dispatches currently running for the message.
+			std::uint32_t Dispatching;
+			/// The number of removed requests still waiting to be cleaned out.
+			std::uint32_t Removed;
+			/// Set when requests were reprioritized during dispatch.
+			bool Dirty;
+
+			/// Posted messages, created on the first post.
+			std::unique_ptr<BaseMessageQueue> Queue;
+			/// Should posted messages replace earlier ones for the same receiver.
+			bool Coalesce;
+			/// Can the requests be called in parallel.
+			bool ThreadSafe;
+
+			/// Messages mailed from other threads, only exists if created.
+			std::unique_ptr<BaseMailbox> Mailbox;
+		};
+
+		enum
+		{
+			/// The number of requests to call in a single parallel job.
+			sParallelChunkSize = 256
 		};
+
+		/// Flags a receiver index as pointing into MessageData::Added.
+		static constexpr std::size_t sAddedIndex = ~(~std::size_t(0) >> 1);
+
+		/** Keeps the callbacks of a message stable while it's being dispatched.
+		 *
+		 * Any changes made to the requests while a dispatch is running are
+		 * deferred until the outermost dispatch of the message is done.
+		 */
+		struct DispatchScope
+		{
+			DispatchScope(const MessageSystem& system, const MessageData& message);
+			DispatchScope(const DispatchScope&) = delete;
+			~DispatchScope();
+
+			DispatchScope& operator=(const DispatchScope&) = delete;
+
+			MessageSystem& System;
+			MessageData& Message;
+		};
+		/// Flags the calling thread as running the requests of a thread-safe message.
+		struct ParallelScope
+		{
+			ParallelScope();
+			ParallelScope(const ParallelScope&) = delete;
+			~ParallelScope();
+
+			ParallelScope& operator=(const ParallelScope&) = delete;
+
+			bool Previous;
+		};
+
+		template<typename... Args, typename Functor>
+		void addRequest(MessageData& message, ComponentId cId, Functor&& func, float prio);
+		void changePriority(MessageData& message, ComponentId cId, float prio);
+
+		template<typename... Args>
+		void dispatch(const MessageData& message, Args&... args) const;
+		template<typename... Args>
+		void dispatchParallel(const MessageData& message, Args&... args) const;
+		template<typename... Args>
+		void dispatchTo(const MessageData& message, ComponentId cId, Args&... args) const;
+		template<typename... Args>
+		void dispatchTo(const MessageData& message, EntityId eId, Args&... args) const;
+
+		template<typename... Args, typename... Params>
+		void enqueue(MessageData& message, ComponentId target, Params&&... params);
+
+		template<typename... Args, typename Functor>
+		void requestChannel(const Channel<Args...>*, MessageData& message, ComponentId cId, Functor&& func, float prio);
+		template<typename... Args>
+		void sendChannel(const Channel<Args...>*, const MessageData& message, typename ident<Args>::type... args) const;
+		template<typename... Args>
+		void sendChannelTo(const Channel<Args...>*, const MessageData& message, ComponentId cId, typename ident<Args>::type... args) const;
+		template<typename... Args>
+		void sendChannelTo(const Channel<Args...>*, const MessageData& message, EntityId eId, typename ident<Args>::type... args) const;
+
+		template<typename... Args, typename... Params>
+		bool mailEntry(const MessageData* message, ComponentId target, Params&&... params);
+		template<typename... Args, typename... Params>
+		bool mailChannel(const Channel<Args...>*, const MessageData* message, ComponentId target, Params&&... params);
+		template<typename... Args>
+		MailboxHandle<typename std::decay<Args>::type...> createChannelMailbox(const Channel<Args...>*, MessageData& message, std::size_t capacity);
+
+		template<typename... Args, typename... Params>
+		void postChannel(const Channel<Args...>*, MessageData& message, ComponentId target, Params&&... params);
+
+		MessageData& getChannel(std::size_t family);
+		const MessageData* getChannel(std::size_t family) const;
+
+		MessageCallback* findCallback(const MessageData& message, ComponentId cId) const;
+		void insertCallback(MessageData& message, MessageCallback&& callback);
+		void removeCallback(MessageData& message, ComponentId cId);
+		void applyDeferred(MessageData& message);
+		void reindex(MessageData& message, std::size_t first);
+
 		std::unordered_map<MessageId, MessageData> mMessages;
+		/// Channel messages, indexed by channel family.
+		std::deque<MessageData> mChannels;
+		/// The messages each component has requested, for quick teardown.
+		std::unordered_map<ComponentId, std::vector<MessageData*>> mSubscriptions;
+		/// Messages with posts waiting for the next flush, and the ones being flushed.
+		std::vector<MessageData*> mQueued, mFlushing;
+		/// Messages that have a mailbox.
+		std::vector<MessageData*> mMailboxes;
+		bool mIsFlushing;
+		detail::JobQueue* mJobQueue;
 	};
 
 }
@@ -2,8 +2,11 @@
 
 #include "MessageSystem.hpp"
 #include "EntitySystem.hpp"
+#include "detail/JobQueue.hpp"
 
 #include <algorithm>
+#include <cassert>
+#include <new>
 
 namespace Kunlaboro
 {
@@ -46,6 +49,8 @@ namespace Kunlaboro
 	template<typename... Args>
 	inline void MessageSystem::registerMessage(MessageId mId, const char* const name, MessageLocality locality)
 	{
+		assert(!inParallelDispatch() && "Thread-safe requests can only mail messages.");
+
 		if (mMessages.count(mId) > 0)
 			return;
 
@@ -64,107 +69,518 @@ namespace Kunlaboro
 	template<typename... Args, typename Functor>
 	inline void MessageSystem::requestMessage(ComponentId cId, MessageId mId, Functor&& func, float prio)
 	{
-		if (mMessages.count(mId) == 0)
+		auto found = mMessages.find(mId);
+		if (found == mMessages.end())
 			return;
 
-		auto& message = mMessages[mId];
+		auto& message = found->second;
 		auto* msgType = static_cast<MessageType<Args...>*>(message.Type);
 
 		if (!msgType->isValid(func))
 			return;
 
-		auto it = std::find_if(message.Callbacks.cbegin(), message.Callbacks.cend(), [cId](const BaseMessageCallback* cb) { return cb->Component == cId; });
-		if (it != message.Callbacks.end())
-		{
-			delete *it;
-			message.Callbacks.erase(it);
-		}
-
-		message.Callbacks.insert(
-			std::lower_bound(message.Callbacks.cbegin(), message.Callbacks.cend(), prio, [](const BaseMessageCallback* cb, float p) { return cb->Priority < p; }),
-			new MessageCallback<Args...>(
-				cId,
-				prio,
-				func
-				));
+		addRequest<Args...>(message, cId, std::forward<Functor>(func), prio);
 	}
 	inline void MessageSystem::unrequestMessage(ComponentId cId, MessageId mId)
 	{
-		if (mMessages.count(mId) == 0)
+		auto found = mMessages.find(mId);
+		if (found == mMessages.end())
 			return;
 
-		auto& message = mMessages[mId];
-		auto it = std::find_if(message.Callbacks.cbegin(), message.Callbacks.cend(), [cId](const BaseMessageCallback* cb) { return cb->Component == cId; });
-		if (it == message.Callbacks.end())
+		removeCallback(found->second, cId);
+	}
+	inline void MessageSystem::reprioritizeMessage(ComponentId cId, MessageId mId, float prio)
+	{
+		auto found = mMessages.find(mId);
+		if (found == mMessages.end())
 			return;
 
-		delete *it;
-		message.Callbacks.erase(it);
+		changePriority(found->second, cId, prio);
 	}
+	template<typename... Args>
+	inline void MessageSystem::sendMessage(MessageId mId, Args&&... args) const
+	{
+		auto found = mMessages.find(mId);
+		if (found == mMessages.end())
+			return;
 
-	inline void MessageSystem::reprioritizeMessage(ComponentId cId, MessageId mId, float prio)
+		dispatch<Args...>(found->second, args...);
+	}
+	template<typename... Args>
+	inline void MessageSystem::sendMessageTo(MessageId mId, ComponentId cId, Args&&... args) const
 	{
-		if (mMessages.count(mId) == 0)
+		auto found = mMessages.find(mId);
+		if (found == mMessages.end())
 			return;
 
-		auto& message = mMessages[mId];
-		auto it = std::find_if(message.Callbacks.cbegin(), message.Callbacks.cend(), [cId](const BaseMessageCallback* cb) { return cb->Component == cId; });
-		if (it == message.Callbacks.end())
+		dispatchTo<Args...>(found->second, cId, args...);
+	}
+	template<typename... Args>
+	inline void MessageSystem::sendMessageTo(MessageId mId, EntityId eId, Args&&... args) const
+	{
+		auto found = mMessages.find(mId);
+		if (found == mMessages.end())
 			return;
 
-		message.Callbacks.erase(it);
+		dispatchTo<Args...>(found->second, eId, args...);
+	}
 
-		auto newPos = std::lower_bound(message.Callbacks.cbegin(), message.Callbacks.cend(), prio, [](const BaseMessageCallback* cb, float p) { return cb->Priority < p; });
-		message.Callbacks.insert(newPos, *it);
+	template<typename T, typename Functor>
+	inline void MessageSystem::request(ComponentId cId, Functor&& func, float prio)
+	{
+		requestChannel(static_cast<const T*>(nullptr), getChannel(ChannelFamily<T>::getFamily()), cId, std::forward<Functor>(func), prio);
+	}
+	template<typename T>
+	inline void MessageSystem::unrequest(ComponentId cId)
+	{
+		removeCallback(getChannel(ChannelFamily<T>::getFamily()), cId);
 	}
+	template<typename T>
+	inline void MessageSystem::reprioritize(ComponentId cId, float prio)
+	{
+		changePriority(getChannel(ChannelFamily<T>::getFamily()), cId, prio);
+	}
+	template<typename T, typename... Args>
+	inline void MessageSystem::send(Args&&... args) const
+	{
+		auto* message = getChannel(ChannelFamily<T>::getFamily());
+		if (message)
+			sendChannel(static_cast<const T*>(nullptr), *message, std::forward<Args>(args)...);
+	}
+	template<typename T, typename... Args>
+	inline void MessageSystem::sendTo(ComponentId cId, Args&&... args) const
+	{
+		auto* message = getChannel(ChannelFamily<T>::getFamily());
+		if (message)
+			sendChannelTo(static_cast<const T*>(nullptr), *message, cId, std::forward<Args>(args)...);
+	}
+	template<typename T, typename... Args>
+	inline void MessageSystem::sendTo(EntityId eId, Args&&... args) const
+	{
+		auto* message = getChannel(ChannelFamily<T>::getFamily());
+		if (message)
+			sendChannelTo(static_cast<const T*>(nullptr), *message, eId, std::forward<Args>(args)...);
+	}
+
 	template<typename... Args>
-	inline void MessageSystem::sendMessage(MessageId mId, Args&&... args) const
+	inline void MessageSystem::postMessage(MessageId mId, Args&&... args)
 	{
-		if (mMessages.count(mId) == 0)
+		auto found = mMessages.find(mId);
+		if (found == mMessages.end())
 			return;
 
-		auto& message = mMessages.at(mId);
-		if (message.Locality & Message_Global)
+		enqueue<typename std::decay<Args>::type...>(found->second, ComponentId::Invalid(), std::forward<Args>(args)...);
+	}
+	template<typename... Args>
+	inline void MessageSystem::postMessageTo(MessageId mId, ComponentId cId, Args&&... args)
+	{
+		auto found = mMessages.find(mId);
+		if (found == mMessages.end())
+			return;
+
+		enqueue<typename std::decay<Args>::type...>(found->second, cId, std::forward<Args>(args)...);
+	}
+	template<typename T, typename... Args>
+	inline void MessageSystem::post(Args&&... args)
+	{
+		postChannel(static_cast<const T*>(nullptr), getChannel(ChannelFamily<T>::getFamily()), ComponentId::Invalid(), std::forward<Args>(args)...);
+	}
+	template<typename T, typename... Args>
+	inline void MessageSystem::postTo(ComponentId cId, Args&&... args)
+	{
+		postChannel(static_cast<const T*>(nullptr), getChannel(ChannelFamily<T>::getFamily()), cId, std::forward<Args>(args)...);
+	}
+	template<typename T>
+	inline void MessageSystem::setCoalescing(bool coalesce)
+	{
+		getChannel(ChannelFamily<T>::getFamily()).Coalesce = coalesce;
+	}
+	template<typename T>
+	inline void MessageSystem::setThreadSafe(bool threadSafe)
+	{
+		getChannel(ChannelFamily<T>::getFamily()).ThreadSafe = threadSafe;
+	}
+
+	template<typename... Args, typename... Params>
+	inline void MessageSystem::enqueue(MessageData& message, ComponentId target, Params&&... params)
+	{
+		typedef MessageQueue<Args...> QueueType;
+
+		assert(!inParallelDispatch() && "Thread-safe requests can only mail messages.");
+
+		if (!message.Queue)
+			message.Queue.reset(new QueueType());
+
+		auto& queue = static_cast<QueueType&>(*message.Queue);
+		if (queue.Entries.empty())
+			mQueued.push_back(&message);
+
+		if (message.Coalesce)
 		{
-			auto copy = message.Callbacks;
+			auto& slot = queue.findIndex(target);
+			if (slot != 0)
+			{
+				queue.Entries[slot - 1].second = typename QueueType::Arguments(std::forward<Params>(params)...);
+				return;
+			}
 
-			for (auto& cb : copy)
-				static_cast<MessageCallback<Args...>*>(cb)->Func(std::forward<Args>(args)...);
+			slot = queue.Entries.size() + 1;
+			++queue.Indexed;
 		}
+
+		queue.Entries.emplace_back(target, typename QueueType::Arguments(std::forward<Params>(params)...));
 	}
+
 	template<typename... Args>
-	inline void MessageSystem::sendMessageTo(MessageId mId, ComponentId cId, Args&&... args) const
+	void MessageSystem::MessageQueue<Args...>::flush(const MessageSystem& system, const MessageData& message)
 	{
-		if (mMessages.count(mId) == 0)
-			return;
+		// Messages posted during delivery end up in the fresh queue
+		std::swap(Entries, Flushing);
+		if (Indexed > 0)
+		{
+			std::fill(Index.begin(), Index.end(), 0);
+			Indexed = 0;
+		}
+
+		for (auto& entry : Flushing)
+			deliver(system, message, entry, std::index_sequence_for<Args...>());
 
-		auto& message = mMessages.at(mId);
-		if (message.Locality & Message_Local)
+		Flushing.clear();
+	}
+	template<typename... Args>
+	std::size_t& MessageSystem::MessageQueue<Args...>::findIndex(ComponentId target)
+	{
+		// Kept at most half full, so probing stays short
+		if ((Indexed + 1) * 2 > Index.size())
 		{
-			auto it = std::find_if(message.Callbacks.cbegin(), message.Callbacks.cend(), [cId](const BaseMessageCallback* cb) { return cb->Component == cId; });
+			std::vector<std::size_t> old(std::max<std::size_t>(Index.size() * 2, 16), 0);
+			old.swap(Index);
+			Indexed = 0;
 
-			if (it == message.Callbacks.cend())
-				return;
+			for (auto position : old)
+				if (position != 0)
+				{
+					findIndex(Entries[position - 1].first) = position;
+					++Indexed;
+				}
+		}
+
+		const auto mask = Index.size() - 1;
+		auto bucket = std::size_t((std::uint64_t(std::hash<ComponentId>()(target)) * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+		while (Index[bucket] != 0 && Entries[Index[bucket] - 1].first != target)
+			bucket = (bucket + 1) & mask;
+
+		return Index[bucket];
+	}
+	template<typename... Args>
+	template<std::size_t... I>
+	void MessageSystem::MessageQueue<Args...>::deliver(const MessageSystem& system, const MessageData& message, Entry& entry, std::index_sequence<I...>)
+	{
+		if (entry.first == ComponentId::Invalid())
+			system.dispatch<Args...>(message, std::get<I>(entry.second)...);
+		else
+			system.dispatchTo<Args...>(message, entry.first, std::get<I>(entry.second)...);
+	}
+
+	template<typename... Args>
+	inline MessageSystem::MailboxHandle<typename std::decay<Args>::type...> MessageSystem::createMailbox(MessageId mId, std::size_t capacity)
+	{
+		typedef Mailbox<typename std::decay<Args>::type...> MailboxType;
 
-			static_cast<MessageCallback<Args...>*>(*it)->Func(std::forward<Args>(args)...);
+		auto found = mMessages.find(mId);
+		if (found == mMessages.end())
+			return MailboxHandle<typename std::decay<Args>::type...>();
+
+		auto& message = found->second;
+		if (!message.Mailbox)
+		{
+			message.Mailbox.reset(new MailboxType(capacity));
+			mMailboxes.push_back(&message);
 		}
+
+		return MailboxHandle<typename std::decay<Args>::type...>(static_cast<MailboxType*>(message.Mailbox.get()));
+	}
+	template<typename T>
+	inline MessageSystem::ChannelMailbox<T> MessageSystem::createMailbox(std::size_t capacity)
+	{
+		return createChannelMailbox(static_cast<const T*>(nullptr), getChannel(ChannelFamily<T>::getFamily()), capacity);
 	}
 	template<typename... Args>
-	inline void MessageSystem::sendMessageTo(MessageId mId, EntityId eId, Args&&... args) const
+	inline bool MessageSystem::mailMessage(MessageId mId, Args&&... args)
+	{
+		auto found = mMessages.find(mId);
+		if (found == mMessages.end())
+			return false;
+
+		return mailEntry<typename std::decay<Args>::type...>(&found->second, ComponentId::Invalid(), std::forward<Args>(args)...);
+	}
+	template<typename... Args>
+	inline bool MessageSystem::mailMessageTo(MessageId mId, ComponentId cId, Args&&... args)
+	{
+		auto found = mMessages.find(mId);
+		if (found == mMessages.end())
+			return false;
+
+		return mailEntry<typename std::decay<Args>::type...>(&found->second, cId, std::forward<Args>(args)...);
+	}
+	template<typename T, typename... Args>
+	inline bool MessageSystem::mail(Args&&... args)
+	{
+		const auto* self = this;
+		return mailChannel(static_cast<const T*>(nullptr), self->getChannel(ChannelFamily<T>::getFamily()), ComponentId::Invalid(), std::forward<Args>(args)...);
+	}
+	template<typename T, typename... Args>
+	inline bool MessageSystem::mailTo(ComponentId cId, Args&&... args)
+	{
+		const auto* self = this;
+		return mailChannel(static_cast<const T*>(nullptr), self->getChannel(ChannelFamily<T>::getFamily()), cId, std::forward<Args>(args)...);
+	}
+
+	template<typename... Args, typename... Params>
+	inline bool MessageSystem::mailEntry(const MessageData* message, ComponentId target, Params&&... params)
+	{
+		if (!message || !message->Mailbox)
+			return false;
+
+		auto& mailbox = static_cast<Mailbox<Args...>&>(*message->Mailbox);
+		return mailbox.Entries.push(target, typename Mailbox<Args...>::Arguments(std::forward<Params>(params)...));
+	}
+	template<typename... Args, typename... Params>
+	inline bool MessageSystem::mailChannel(const Channel<Args...>*, const MessageData* message, ComponentId target, Params&&... params)
 	{
-		if (mMessages.count(mId) == 0)
+		return mailEntry<typename std::decay<Args>::type...>(message, target, std::forward<Params>(params)...);
+	}
+	template<typename... Args>
+	inline MessageSystem::MailboxHandle<typename std::decay<Args>::type...> MessageSystem::createChannelMailbox(const Channel<Args...>*, MessageData& message, std::size_t capacity)
+	{
+		typedef Mailbox<typename std::decay<Args>::type...> MailboxType;
+
+		if (!message.Mailbox)
+		{
+			message.Mailbox.reset(new MailboxType(capacity));
+			mMailboxes.push_back(&message);
+		}
+
+		return MailboxHandle<typename std::decay<Args>::type...>(static_cast<MailboxType*>(message.Mailbox.get()));
+	}
+
+	template<typename... Args>
+	template<typename... Params>
+	inline bool MessageSystem::MailboxHandle<Args...>::mail(Params&&... params) const
+	{
+		return mailTo(ComponentId::Invalid(), std::forward<Params>(params)...);
+	}
+	template<typename... Args>
+	template<typename... Params>
+	inline bool MessageSystem::MailboxHandle<Args...>::mailTo(ComponentId cId, Params&&... params) const
+	{
+		if (!mMailbox)
+			return false;
+
+		return mMailbox->Entries.push(cId, typename Mailbox<Args...>::Arguments(std::forward<Params>(params)...));
+	}
+
+	template<typename... Args>
+	void MessageSystem::Mailbox<Args...>::drain(const MessageSystem& system, const MessageData& message)
+	{
+		// Bounded, so that messages mailed during the drain can't keep it going forever
+		auto remaining = Entries.getCapacity();
+		while (remaining-- > 0 && Entries.pop([&system, &message](Entry& entry) {
+			MessageQueue<Args...>::deliver(system, message, entry, std::index_sequence_for<Args...>());
+		}))
+			;
+	}
+
+	template<typename... Args, typename... Params>
+	inline void MessageSystem::postChannel(const Channel<Args...>*, MessageData& message, ComponentId target, Params&&... params)
+	{
+		enqueue<typename std::decay<Args>::type...>(message, target, std::forward<Params>(params)...);
+	}
+	template<typename... Args, typename Functor>
+	inline void MessageSystem::requestChannel(const Channel<Args...>*, MessageData& message, ComponentId cId, Functor&& func, float prio)
+	{
+		static_assert(MessageType<Args...>::template can_call<Functor>::value, "The functor can't be called with the arguments of the channel.");
+
+		addRequest<Args...>(message, cId, std::forward<Functor>(func), prio);
+	}
+	template<typename... Args>
+	inline void MessageSystem::sendChannel(const Channel<Args...>*, const MessageData& message, typename ident<Args>::type... args) const
+	{
+		dispatch<Args...>(message, args...);
+	}
+	template<typename... Args>
+	inline void MessageSystem::sendChannelTo(const Channel<Args...>*, const MessageData& message, ComponentId cId, typename ident<Args>::type... args) const
+	{
+		dispatchTo<Args...>(message, cId, args...);
+	}
+	template<typename... Args>
+	inline void MessageSystem::sendChannelTo(const Channel<Args...>*, const MessageData& message, EntityId eId, typename ident<Args>::type... args) const
+	{
+		dispatchTo<Args...>(message, eId, args...);
+	}
+
+	template<typename... Args, typename Functor>
+	inline void MessageSystem::addRequest(MessageData& message, ComponentId cId, Functor&& func, float prio)
+	{
+		MessageCallback callback(cId, prio);
+		callback.assign<Args...>(std::forward<Functor>(func));
+
+		removeCallback(message, cId);
+		insertCallback(message, std::move(callback));
+	}
+
+	template<typename... Args>
+	inline void MessageSystem::dispatch(const MessageData& message, Args&... args) const
+	{
+		if (!(message.Locality & Message_Global))
 			return;
 
-		auto& message = mMessages.at(mId);
-		if (message.Locality & Message_Local)
+		if (message.ThreadSafe && mJobQueue && message.Callbacks.size() > sParallelChunkSize)
 		{
-			for (auto& cb : message.Callbacks)
-			{
-				if (!mES->isAttached(cb->Component, eId))
-					continue;
+			dispatchParallel<Args...>(message, args...);
+			return;
+		}
+
+		DispatchScope scope(*this, message);
 
-				static_cast<MessageCallback<Args...>*>(cb)->Func(std::forward<Args>(args)...);
+		// Requests added during the dispatch are deferred, so the size is stable
+		const auto count = message.Callbacks.size();
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			auto& cb = message.Callbacks[i];
+			if (!cb.Removed)
+				cb.invoke<Args...>(args...);
+		}
+	}
+	template<typename... Args>
+	inline void MessageSystem::dispatchParallel(const MessageData& message, Args&... args) const
+	{
+		DispatchScope scope(*this, message);
+
+		const auto& callbacks = message.Callbacks;
+		const auto count = callbacks.size();
+		auto call = [&callbacks, &args...](std::size_t begin, std::size_t end) {
+			ParallelScope parallel;
+			for (auto i = begin; i < end; ++i)
+				if (!callbacks[i].Removed)
+					callbacks[i].invoke<Args...>(args...);
+		};
+
+		// Requests are run in bands of equal priority, one band at a time
+		std::size_t begin = 0;
+		while (begin < count)
+		{
+			auto end = begin + 1;
+			while (end < count && callbacks[end].Priority == callbacks[begin].Priority)
+				++end;
+
+			if (end - begin <= sParallelChunkSize)
+				call(begin, end);
+			else
+			{
+				for (auto chunk = begin; chunk < end; chunk += sParallelChunkSize)
+				{
+					const auto last = std::min<std::size_t>(chunk + sParallelChunkSize, end);
+					mJobQueue->submit([&call, chunk, last]() { call(chunk, last); });
+				}
+				mJobQueue->wait();
 			}
+
+			begin = end;
+		}
+	}
+	template<typename... Args>
+	inline void MessageSystem::dispatchTo(const MessageData& message, ComponentId cId, Args&... args) const
+	{
+		if (!(message.Locality & Message_Local))
+			return;
+
+		auto* cb = findCallback(message, cId);
+		if (!cb)
+			return;
+
+		DispatchScope scope(*this, message);
+		cb->invoke<Args...>(args...);
+	}
+	template<typename... Args>
+	inline void MessageSystem::dispatchTo(const MessageData& message, EntityId eId, Args&... args) const
+	{
+		if (!(message.Locality & Message_Local) || !mES->isAlive(eId))
+			return;
+
+		// Only the components on the entity are looked up, in priority order
+		MessageCallback* receivers[std::size_t(ComponentId::sMaxFamily) + 1];
+		std::size_t count = 0;
+
+		auto& entity = mES->entityGetList()[eId.getIndex()];
+		for (std::size_t family = 0; family < entity.Components.size(); ++family)
+		{
+			if (!entity.ComponentBits.hasBit(family))
+				continue;
+
+			auto* cb = findCallback(message, entity.Components[family]);
+			if (!cb)
+				continue;
+
+			auto pos = count++;
+			for (; pos > 0 && receivers[pos - 1]->Priority > cb->Priority; --pos)
+				receivers[pos] = receivers[pos - 1];
+			receivers[pos] = cb;
 		}
+
+		if (count == 0)
+			return;
+
+		DispatchScope scope(*this, message);
+		for (std::size_t i = 0; i < count; ++i)
+			if (!receivers[i]->Removed)
+				receivers[i]->invoke<Args...>(args...);
+	}
+
+	inline MessageSystem::MessageData& MessageSystem::getChannel(std::size_t family)
+	{
+		// Growing a deque at the end keeps existing channels in place
+		if (mChannels.size() <= family)
+			mChannels.resize(family + 1);
+
+		return mChannels[family];
+	}
+	inline const MessageSystem::MessageData* MessageSystem::getChannel(std::size_t family) const
+	{
+		if (mChannels.size() <= family)
+			return nullptr;
+
+		return &mChannels[family];
+	}
+
+	inline MessageSystem::MessageCallback* MessageSystem::findCallback(const MessageData& message, ComponentId cId) const
+	{
+		auto it = message.Receivers.find(cId);
+		if (it == message.Receivers.end())
+			return nullptr;
+
+		auto& data = const_cast<MessageData&>(message);
+		auto* cb = (it->second & sAddedIndex ? &data.Added[it->second & ~sAddedIndex] : &data.Callbacks[it->second]);
+		return (cb->Removed ? nullptr : cb);
+	}
+
+	template<typename... Args, typename Functor>
+	void MessageSystem::MessageCallback::assign(Functor&& func)
+	{
+		typedef typename std::decay<Functor>::type FunctorType;
+
+		mFunctor.template emplace<FunctorType>(std::forward<Functor>(func));
+		mInvoke = reinterpret_cast<InvokeFunc>(&invokeFunctor<FunctorType, Args...>);
+	}
+	template<typename... Args>
+	void MessageSystem::MessageCallback::invoke(Args&... args) const
+	{
+		reinterpret_cast<void(*)(const Storage&, Args&...)>(mInvoke)(mFunctor, args...);
+	}
+
+	template<typename T, typename... Args>
+	void MessageSystem::MessageCallback::invokeFunctor(const Storage& storage, Args&... args)
+	{
+		storage.template get<T>()(args...);
 	}
 }
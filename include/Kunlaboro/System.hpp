@@ -0,0 +1,168 @@
+#pragma once
+
+#include "ID.hpp"
+
+#include "detail/DynamicBitfield.hpp"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace Kunlaboro
+{
+	namespace detail { class JobQueue; }
+
+	class EntitySystem;
+	class SystemScheduler;
+
+	/** The base class for systems that operate on components.
+	 *
+	 * Each system declares which component families it reads and which
+	 * ones it writes, this lets the SystemScheduler run systems that don't
+	 * touch the same data at the same time.
+	 *
+	 * Simple example of a movement system;
+	 * \code{.cpp}
+	 * class PhysicsSystem : public Kunlaboro::System
+	 * {
+	 * public:
+	 * 	PhysicsSystem()
+	 * 	{
+	 * 		writes<Position>();
+	 * 		reads<Velocity>();
+	 * 	}
+	 *
+	 * 	void update(float dt)
+	 * 	{
+	 * 		Kunlaboro::EntityView(*getEntitySystem())
+	 * 			.withComponents<Kunlaboro::Match_All, Position, Velocity>()
+	 * 			.forEach([dt](const Kunlaboro::Entity&, Position& pos, Velocity& vel) {
+	 * 				pos.X += vel.X * dt;
+	 * 				pos.Y += vel.Y * dt;
+	 * 			});
+	 * 	}
+	 * };
+	 * \endcode
+	 */
+	class System
+	{
+	public:
+		System();
+		System(const System&) = delete;
+		virtual ~System() = default;
+
+		System& operator=(const System&) = delete;
+
+		/** Runs a single update of the system.
+		 *
+		 * \param dt The time step of the update.
+		 * \note When run through a parallel scheduler, this will be called
+		 *       from a job queue thread.
+		 */
+		virtual void update(float dt) = 0;
+
+		/// Gets the component families read by the system.
+		inline const detail::DynamicBitfield& getReads() const { return mReads; }
+		/// Gets the component families written by the system.
+		inline const detail::DynamicBitfield& getWrites() const { return mWrites; }
+
+		/** Checks if the system can't run at the same time as the given system.
+		 *
+		 * Two systems conflict if either of them writes to a component family
+		 * that the other one reads from or writes to.
+		 */
+		bool conflictsWith(const System& other) const;
+
+		/// Gets the entity system that the system is scheduled against.
+		EntitySystem* getEntitySystem();
+		/// Gets the entity system that the system is scheduled against.
+		const EntitySystem* getEntitySystem() const;
+
+	protected:
+		/** Declares that the system reads the given component types.
+		 *
+		 * \tparam Components The component types that are read.
+		 */
+		template<typename... Components>
+		void reads();
+		/** Declares that the system writes the given component types.
+		 *
+		 * \tparam Components The component types that are written.
+		 */
+		template<typename... Components>
+		void writes();
+
+	private:
+		friend class SystemScheduler;
+
+		EntitySystem* mES;
+		detail::DynamicBitfield mReads, mWrites;
+	};
+
+	/** Runs a collection of systems, in parallel where their data allows it.
+	 *
+	 * Systems are run in the order they were added, except that systems which
+	 * don't conflict with any earlier system still waiting to run can be
+	 * started at the same time.
+	 *
+	 * \sa System::conflictsWith()
+	 */
+	class SystemScheduler
+	{
+	public:
+		SystemScheduler(EntitySystem& es);
+		SystemScheduler(const SystemScheduler&) = delete;
+		~SystemScheduler();
+
+		SystemScheduler& operator=(const SystemScheduler&) = delete;
+
+		/** Creates and adds a system to the scheduler.
+		 *
+		 * \tparam T The type of system to create.
+		 * \param args The arguments to pass to the constructor of the system.
+		 */
+		template<typename T, typename... Args>
+		T& addSystem(Args&&... args);
+		/** Removes and destroys a system from the scheduler.
+		 *
+		 * \param system The system to remove.
+		 */
+		void removeSystem(const System& system);
+
+		/// Gets the number of systems in the scheduler.
+		inline std::size_t getSystemCount() const { return mSystems.size(); }
+
+		/** Runs all systems sequentially, in the order they were added.
+		 *
+		 * \param dt The time step to pass to the systems.
+		 */
+		void update(float dt);
+		/** Runs all systems on the given job queue.
+		 *
+		 * Systems are started as soon as all the earlier systems they conflict
+		 * with have finished. This call blocks until all systems have run.
+		 *
+		 * \param dt The time step to pass to the systems.
+		 * \param queue The job queue to run the systems on.
+		 */
+		void update(float dt, detail::JobQueue& queue);
+
+	private:
+		struct SystemNode
+		{
+			std::vector<std::size_t> Dependents;
+			std::uint32_t DependencyCount;
+		};
+
+		void addSystem(System* system);
+		void buildGraph();
+		void runSystem(std::size_t index, float dt, detail::JobQueue& queue);
+
+		EntitySystem* mES;
+		bool mDirty;
+
+		std::vector<std::unique_ptr<System>> mSystems;
+		std::vector<SystemNode> mNodes;
+		std::unique_ptr<std::atomic<std::uint32_t>[]> mRemaining;
+	};
+}
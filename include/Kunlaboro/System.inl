@@ -0,0 +1,35 @@
+#pragma once
+
+#include "System.hpp"
+#include "Component.hpp"
+
+#include <type_traits>
+#include <utility>
+
+namespace Kunlaboro
+{
+
+	template<typename... Components>
+	void System::reads()
+	{
+		int expand[] = { 0, (mReads.setBit(Kunlaboro::ComponentFamily<Components>::getFamily()), 0)... };
+		(void)expand;
+	}
+	template<typename... Components>
+	void System::writes()
+	{
+		int expand[] = { 0, (mWrites.setBit(Kunlaboro::ComponentFamily<Components>::getFamily()), 0)... };
+		(void)expand;
+	}
+
+	template<typename T, typename... Args>
+	T& SystemScheduler::addSystem(Args&&... args)
+	{
+		static_assert(std::is_base_of<System, T>::value, "Only systems can be scheduled.");
+
+		auto* system = new T(std::forward<Args>(args)...);
+		addSystem(static_cast<System*>(system));
+		return *system;
+	}
+
+}
@@ -2,12 +2,14 @@
 
 #include "ID.hpp"
 #include "Entity.hpp"
+#include "EntitySystem.hpp"
 
 #include "detail/Delegate.hpp"
 #include "detail/DynamicBitfield.hpp"
+#include "detail/FunctionRef.hpp"
 
-#include <functional>
 #include <type_traits>
+#include <utility>
 
 namespace Kunlaboro
 {
@@ -22,6 +24,16 @@ namespace Kunlaboro
 		Match_Any
 	};
 
+	/** The order in which partial results of a reduction are combined.
+	 */
+	enum ReduceOrder
+	{
+		/// Partial results are combined in whatever way distributes the work best.
+		Reduce_Unordered,
+		/// Partial results are combined in a fixed order, independent of thread count.
+		Reduce_Ordered
+	};
+
 	namespace impl
 	{
 
@@ -95,6 +107,41 @@ namespace Kunlaboro
 		};
 
 		bool matchBitfield(const detail::DynamicBitfield& entity, const detail::DynamicBitfield& bitField, MatchType match);
+
+		/** Reduces an index range, in parallel if given a job queue.
+		 *
+		 * \param queue The job queue to run on, or nullptr to reduce sequentially.
+		 * \param count The number of indices in the range.
+		 * \param chunkSize The number of indices to accumulate in each chunk.
+		 * \param identity The starting value of every partial accumulator.
+		 * \param accumulateRange Called as accumulateRange(Result, begin, end) for every chunk.
+		 * \param combine Called as combine(Result, Result) to merge partial results.
+		 * \param order The order to combine partial results in.
+		 */
+		template<typename Result, typename AccumulateRange, typename Combine>
+		Result reduceRange(detail::JobQueue* queue, std::size_t count, std::size_t chunkSize, const Result& identity, AccumulateRange& accumulateRange, Combine& combine, ReduceOrder order);
+
+		/// Gets a pointer to a component of the given type in an entity, or nullptr.
+		template<typename T>
+		T* getComponentData(const EntitySystem& es, const EntitySystem::EntityData& entity);
+
+		/// Checks if a functor can be called with the arguments of the given signature.
+		template<typename Functor, typename Signature, typename = void>
+		struct IsCallable : std::false_type { };
+		template<typename Functor, typename... Args>
+		struct IsCallable<Functor, void(Args...), decltype(void(std::declval<Functor&>()(std::declval<Args>()...)))> : std::true_type { };
+
+		/// Helper for passing components as pointers or references depending on the match type.
+		template<MatchType MT, typename T>
+		struct ComponentArgument
+		{
+			static inline T* get(T* comp) { return comp; }
+		};
+		template<typename T>
+		struct ComponentArgument<Match_All, T>
+		{
+			static inline T& get(T* comp) { return *comp; }
+		};
 	}
 
 	/** A view for iterating components in an entity system.
@@ -112,6 +159,8 @@ namespace Kunlaboro
 		typedef detail::Delegate<bool(const T&)> Predicate;
 		/// The function-call function type.
 		typedef detail::Delegate<void(T&)> Function;
+		/// The non-owning function-call type, used by the type-erased forEach.
+		typedef detail::FunctionRef<void(T&)> FunctionRef;
 
 		struct Iterator : public impl::BaseIterator<Iterator, T>
 		{
@@ -137,7 +186,84 @@ namespace Kunlaboro
 		Iterator begin();
 		Iterator end();
 
-		virtual void forEach(const Function& func);
+		/** Calls the given function for every component in the view.
+		 *
+		 * \param func Called as func(T&) for every matching component.
+		 * \note The function is called directly, without any type erasure.
+		 */
+		template<typename Functor>
+		void forEach(Functor&& func);
+		virtual void forEach(const FunctionRef& func);
+
+		/** Iterates the components in the view one memory block at a time.
+		 *
+		 * The kernel is called as kernel(T* components, std::size_t count, const std::uint64_t* mask)
+		 * once for every memory block containing live components, where \p components points to
+		 * \p count contiguous component slots.
+		 *
+		 * If every slot in the block is live then \p mask is nullptr, otherwise it points to
+		 * an occupancy bitmask where bit (i % 64) of word (i / 64) is set if slot i is live.
+		 * Dead slots must not be touched.
+		 *
+		 * This allows for writing tight - vectorizable - loops over component data,
+		 * without paying for a function call per component.
+		 *
+		 * \note The view predicate is not applied to chunks.
+		 * \note When the view is parallel, each block is run as a separate job.
+		 */
+		template<typename Kernel>
+		void forEachChunk(Kernel&& kernel);
+		/** Iterates the field columns of structure of array components one memory block at a time.
+		 *
+		 * The kernel is called as kernel(std::size_t count, const std::uint64_t* mask, Fields*... columns)
+		 * once for every memory block containing live components, with one pointer for every field
+		 * declared by the component, each pointing to \p count contiguous field values.
+		 *
+		 * The occupancy mask works the same as in forEachChunk().
+		 *
+		 * \note Only available for components deriving from SoAComponent.
+		 * \note The view predicate is not applied to chunks.
+		 * \sa forEachChunk()
+		 */
+		template<typename Kernel>
+		void forEachFields(Kernel&& kernel);
+
+		/** Reduces all components in the view into a single value.
+		 *
+		 * When the view is parallel, the components are split into chunks
+		 * which are accumulated separately on the job queue, the partial
+		 * results are then combined at the end.
+		 *
+		 * \param identity The starting value of every partial result,
+		 *                 must be an identity value for \p combine.
+		 * \param accumulate Called as accumulate(Result, T&), returning the new partial result.
+		 * \param combine Called as combine(Result, Result), merging two partial results.
+		 * \param order The order to combine the partial results in, use
+		 *              \p Reduce_Ordered for reproducible results.
+		 */
+		template<typename Result, typename Accumulate, typename Combine>
+		Result reduce(Result identity, Accumulate&& accumulate, Combine&& combine, ReduceOrder order = Reduce_Unordered);
+		/** Transforms all components in the view and reduces the results into a single value.
+		 *
+		 * \param identity The starting value of every partial result,
+		 *                 must be an identity value for \p reduce.
+		 * \param reduce Called as reduce(Result, Result), merging two values.
+		 * \param transform Called as transform(T&), turning a component into a value.
+		 * \param order The order to combine the partial results in, use
+		 *              \p Reduce_Ordered for reproducible results.
+		 *
+		 * \sa reduce()
+		 */
+		template<typename Result, typename Reduce, typename Transform>
+		Result transformReduce(Result identity, Reduce&& reduce, Transform&& transform, ReduceOrder order = Reduce_Unordered);
+
+	private:
+		template<typename Functor>
+		void each(Functor& func);
+		template<typename BlockFunc>
+		void forEachBlock(BlockFunc&& func);
+		template<typename Kernel, std::size_t... Is>
+		void forEachFields(Kernel& kernel, std::index_sequence<Is...>);
 	};
 
 	template<MatchType MT, typename... Components>
@@ -152,6 +278,7 @@ namespace Kunlaboro
 
 		typedef detail::Delegate<bool(const Entity&)> Predicate;
 		typedef detail::Delegate<void(const Entity&)> Function;
+		typedef detail::FunctionRef<void(const Entity&)> FunctionRef;
 
 		struct Iterator : public impl::BaseIterator<Iterator, Entity>
 		{
@@ -184,7 +311,18 @@ namespace Kunlaboro
 		template<MatchType match = Match_All, typename... Components>
 		TypedEntityView<match, Components...> withComponents() const;
 
-		virtual void forEach(const Function& func);
+		/** Calls the given function for every entity in the view.
+		 *
+		 * \param func Called as func(const Entity&) for every matching entity.
+		 * \note The function is called directly, without any type erasure.
+		 */
+		template<typename Functor>
+		void forEach(Functor&& func);
+		virtual void forEach(const FunctionRef& func);
+
+	private:
+		template<typename Functor>
+		void each(Functor& func);
 	};
 
 	/** A view for iterating entities with given components in the given entity system.
@@ -200,30 +338,90 @@ namespace Kunlaboro
 	public:
 		TypedEntityView(const EntitySystem& es);
 
-		typedef std::function<bool(const Entity&)> Predicate;
-		typedef std::function<void(Entity&)> Function;
+		typedef detail::Delegate<bool(const Entity&)> Predicate;
+		typedef detail::Delegate<void(Entity&)> Function;
+		typedef detail::FunctionRef<void(Entity&)> FunctionRef;
 
 		typedef EntityView::Iterator Iterator;
 
 		Iterator begin();
 		Iterator end();
 
-		/** Iterates all entities, using either \p Match_Any or \p Match_All matching.
+		/** Iterates all matching entities.
 		 *
-		 * \param func The function to call with every matching entity and its component pointers.
-		 * \todo Make these work with the new delegates
+		 * \param func
+		 * \parblock
+		 * The function to call with every matching entity, called as either
+		 * func(const Entity&, Components&...) when matching all components,
+		 * func(const Entity&, Components*...) with pointers that are nullptr for missing components,
+		 * or func(Entity&) with only the entity.
+		 * \endparblock
+		 * \note The function is called directly, without any type erasure.
 		 */
-		void forEach(const std::function<void(const Entity&, Components*...)>& func);
-		/** Iterates all entities, using \p Match_All matching.
+		template<typename Functor>
+		void forEach(Functor&& func);
+		virtual void forEach(const FunctionRef& func);
+
+		/** Reduces all matching entities in the view into a single value.
 		 *
-		 * \param func The function to call with every matching entity and its component references.
-		 * \todo Make these work with the new delegates
+		 * When the view is parallel, the entities are split into chunks
+		 * which are accumulated separately on the job queue, the partial
+		 * results are then combined at the end.
+		 *
+		 * \param identity The starting value of every partial result,
+		 *                 must be an identity value for \p combine.
+		 * \param accumulate
+		 * \parblock
+		 * Called as accumulate(Result, const Entity&, Components&...) when matching all components,
+		 * or as accumulate(Result, const Entity&, Components*...) when matching any of them.
+		 * Returns the new partial result.
+		 * \endparblock
+		 * \param combine Called as combine(Result, Result), merging two partial results.
+		 * \param order The order to combine the partial results in, use
+		 *              \p Reduce_Ordered for reproducible results.
 		 */
-		void forEach(const std::function<void(const Entity&, Components&...)>& func);
-
-		virtual void forEach(const Function& func);
+		template<typename Result, typename Accumulate, typename Combine>
+		Result reduce(Result identity, Accumulate&& accumulate, Combine&& combine, ReduceOrder order = Reduce_Unordered);
+		/** Transforms all matching entities in the view and reduces the results into a single value.
+		 *
+		 * \param identity The starting value of every partial result,
+		 *                 must be an identity value for \p reduce.
+		 * \param reduce Called as reduce(Result, Result), merging two values.
+		 * \param transform Called with the same arguments as the accumulator in reduce(),
+		 *                  minus the partial result, turning an entity into a value.
+		 * \param order The order to combine the partial results in, use
+		 *              \p Reduce_Ordered for reproducible results.
+		 *
+		 * \sa reduce()
+		 */
+		template<typename Result, typename Reduce, typename Transform>
+		Result transformReduce(Result identity, Reduce&& reduce, Transform&& transform, ReduceOrder order = Reduce_Unordered);
 
 	private:
+		enum
+		{
+			/// The number of entities accumulated in every chunk of a reduction.
+			sReduceChunkSize = 1024
+		};
+
+		/// The ways of passing the components of an entity to a forEach functor.
+		typedef std::integral_constant<int, 0> EntityArguments;
+		typedef std::integral_constant<int, 1> PointerArguments;
+		typedef std::integral_constant<int, 2> ReferenceArguments;
+
+		template<typename Functor>
+		using ArgumentsFor = typename std::conditional<MT == Match_All && impl::IsCallable<Functor, void(const Entity&, Components&...)>::value, ReferenceArguments,
+			typename std::conditional<impl::IsCallable<Functor, void(const Entity&, Components*...)>::value, PointerArguments, EntityArguments>::type>::type;
+
+		template<typename Functor>
+		void forEach(Functor& func, EntityArguments);
+		template<typename Functor>
+		void forEach(Functor& func, PointerArguments);
+		template<typename Functor>
+		void forEach(Functor& func, ReferenceArguments);
+		template<typename Call>
+		void each(const Call& call);
+
 		template<typename T, typename T2, typename... ComponentsToAdd>
 		inline void addComponents();
 		template<typename T>
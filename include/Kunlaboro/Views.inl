@@ -4,11 +4,91 @@
 #include "Component.hpp"
 #include "EntitySystem.hpp"
 
+#include "detail/ComponentPool.hpp"
 #include "detail/JobQueue.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
 namespace Kunlaboro
 {
 
+	template<typename Result, typename AccumulateRange, typename Combine>
+	Result impl::reduceRange(detail::JobQueue* queue, std::size_t count, std::size_t chunkSize, const Result& identity, AccumulateRange& accumulateRange, Combine& combine, ReduceOrder order)
+	{
+		// Wrapped to keep std::vector<bool> from packing partial results together
+		struct Partial
+		{
+			Result Value;
+		};
+
+		const std::size_t chunks = (count + chunkSize - 1) / chunkSize;
+		std::vector<Partial> partials;
+
+		if (order == Reduce_Ordered)
+		{
+			// Fixed chunk boundaries, so the result doesn't depend on the thread count
+			partials.resize(chunks, Partial{ identity });
+
+			auto runChunk = [&](std::size_t chunk) {
+				partials[chunk].Value = accumulateRange(identity, chunk * chunkSize, std::min(count, (chunk + 1) * chunkSize));
+			};
+
+			if (queue)
+			{
+				for (std::size_t chunk = 0; chunk < chunks; ++chunk)
+					queue->submit([&runChunk, chunk]() { runChunk(chunk); });
+				queue->wait();
+			}
+			else
+				for (std::size_t chunk = 0; chunk < chunks; ++chunk)
+					runChunk(chunk);
+		}
+		else
+		{
+			if (!queue || chunks <= 1)
+				return accumulateRange(identity, 0, count);
+
+			// One accumulator per job, with the jobs grabbing chunks as they go
+			const std::size_t jobs = std::min(queue->getThreadCount(), chunks);
+			partials.resize(jobs, Partial{ identity });
+			std::atomic<std::size_t> nextChunk(0);
+
+			for (std::size_t job = 0; job < jobs; ++job)
+				queue->submit([&, job]() {
+					Result acc = identity;
+
+					std::size_t chunk;
+					while ((chunk = nextChunk.fetch_add(1, std::memory_order_relaxed)) < chunks)
+						acc = accumulateRange(std::move(acc), chunk * chunkSize, std::min(count, (chunk + 1) * chunkSize));
+
+					partials[job].Value = std::move(acc);
+				});
+			queue->wait();
+		}
+
+		Result result = identity;
+		for (auto& partial : partials)
+			result = combine(std::move(result), partial.Value);
+
+		return result;
+	}
+
+	template<typename T>
+	T* impl::getComponentData(const EntitySystem& es, const EntitySystem::EntityData& entity)
+	{
+		const auto family = Kunlaboro::ComponentFamily<T>::getFamily();
+		if (entity.Components.size() <= family || !entity.ComponentBits.hasBit(family))
+			return nullptr;
+
+		const auto cid = entity.Components[family];
+		if (!es.isAlive(cid))
+			return nullptr;
+
+		return static_cast<T*>(const_cast<void*>(es.componentGetPool(family).getData(cid.getIndex())));
+	}
+
 	template<typename ViewType, typename ViewedType>
 	impl::BaseView<ViewType, ViewedType>::BaseView(const EntitySystem* es)
 		: mES(es)
@@ -164,26 +244,170 @@ namespace Kunlaboro
 		return Iterator(impl::BaseView<ComponentView, T>::mES, ComponentId(list.size(), 0, Kunlaboro::ComponentFamily<T>::getFamily()), impl::BaseView<ComponentView, T>::mPred);
 	}
 	template<typename T>
-	void ComponentView<T>::forEach(const Function& func)
+	template<typename Functor>
+	void ComponentView<T>::forEach(Functor&& func)
+	{
+		each(func);
+	}
+	template<typename T>
+	void ComponentView<T>::forEach(const FunctionRef& func)
+	{
+		each(func);
+	}
+	template<typename T>
+	template<typename Functor>
+	void ComponentView<T>::each(Functor& func)
 	{
 		auto family = Kunlaboro::ComponentFamily<T>::getFamily();
 		auto& pool = impl::BaseView<ComponentView, T>::mES->componentGetPool(family);
 		auto* queue = impl::BaseView<ComponentView, T>::mQueue;
 
-		for (std::size_t i = 0; i < pool.getSize(); ++i)
-			if (pool.hasBit(i))
+		const auto size = pool.getSize();
+		for (auto i = pool.findNext(0); i < size; i = pool.findNext(i + 1))
+		{
+			auto& comp = const_cast<T&>(*static_cast<const T*>(pool.getData(i)));
+
+			if (!impl::BaseView<ComponentView, T>::mPred || impl::BaseView<ComponentView, T>::mPred(comp))
+			{
+				if (queue)
+					queue->submit([&func, &comp]() { func(comp); });
+				else
+					func(comp);
+			}
+		}
+
+		if (queue)
+			queue->wait();
+	}
+
+	template<typename T>
+	template<typename BlockFunc>
+	void ComponentView<T>::forEachBlock(BlockFunc&& func)
+	{
+		static_assert(T::sPreferredChunkSize % 64 == 0, "Chunk iteration requires a chunk size that's a multiple of 64.");
+
+		auto family = Kunlaboro::ComponentFamily<T>::getFamily();
+		auto& pool = impl::BaseView<ComponentView, T>::mES->componentGetPool(family);
+		auto* queue = impl::BaseView<ComponentView, T>::mQueue;
+
+		const std::size_t chunkSize = pool.getChunkSize();
+		const std::size_t wordsPerChunk = chunkSize / 64;
+		const std::size_t size = pool.getSize();
+		const std::uint64_t* words = pool.getBits().getWords();
+
+		for (std::size_t block = 0; block * chunkSize < size; ++block)
+		{
+			const std::size_t count = std::min(chunkSize, size - block * chunkSize);
+			const std::uint64_t* mask = words + block * wordsPerChunk;
+
+			// Slots past the pool size are never live, so the live count tells if the block is empty or full
+			const std::size_t live = pool.countBlockBits(block);
+			if (live == 0)
+				continue;
+			if (live == count)
+				mask = nullptr;
+
+			if (queue)
+				queue->submit([&func, block, count, mask]() { func(block, count, mask); });
+			else
+				func(block, count, mask);
+		}
+
+		if (queue)
+			queue->wait();
+	}
+
+	template<typename T>
+	template<typename Kernel>
+	void ComponentView<T>::forEachChunk(Kernel&& kernel)
+	{
+		auto family = Kunlaboro::ComponentFamily<T>::getFamily();
+		auto& pool = const_cast<detail::BaseComponentPool&>(impl::BaseView<ComponentView, T>::mES->componentGetPool(family));
+
+		forEachBlock([&pool, &kernel](std::size_t block, std::size_t count, const std::uint64_t* mask) {
+			kernel(static_cast<T*>(pool.getBlock(block)), count, mask);
+		});
+	}
+
+	template<typename T>
+	template<typename Kernel>
+	void ComponentView<T>::forEachFields(Kernel&& kernel)
+	{
+		static_assert(detail::IsSoAComponent<T>::value, "Field iteration is only available for structure of array components.");
+
+		forEachFields(kernel, std::make_index_sequence<std::tuple_size<typename T::FieldTypes>::value>());
+	}
+	template<typename T>
+	template<typename Kernel, std::size_t... Is>
+	void ComponentView<T>::forEachFields(Kernel& kernel, std::index_sequence<Is...>)
+	{
+		auto family = Kunlaboro::ComponentFamily<T>::getFamily();
+		auto& pool = const_cast<detail::ComponentPool<T>&>(static_cast<const detail::ComponentPool<T>&>(impl::BaseView<ComponentView, T>::mES->componentGetPool(family)));
+
+		forEachBlock([&pool, &kernel](std::size_t block, std::size_t count, const std::uint64_t* mask) {
+			kernel(count, mask, pool.template getFieldColumn<Is>(block)...);
+		});
+	}
+
+	template<typename T>
+	template<typename Result, typename Accumulate, typename Combine>
+	Result ComponentView<T>::reduce(Result identity, Accumulate&& accumulate, Combine&& combine, ReduceOrder order)
+	{
+		auto family = Kunlaboro::ComponentFamily<T>::getFamily();
+		auto& pool = impl::BaseView<ComponentView, T>::mES->componentGetPool(family);
+		const auto& pred = impl::BaseView<ComponentView, T>::mPred;
+
+		auto accumulateRange = [&pool, &pred, &accumulate](Result acc, std::size_t begin, std::size_t end) {
+			for (auto i = pool.findNext(begin); i < end; i = pool.findNext(i + 1))
 			{
 				auto& comp = const_cast<T&>(*static_cast<const T*>(pool.getData(i)));
 
-				if (!impl::BaseView<ComponentView, T>::mPred || impl::BaseView<ComponentView, T>::mPred(comp))
-				{
-					if (queue)
-						queue->submit(Function(func), std::move(comp));
-					else
-						func(comp);
-				}
+				if (!pred || pred(comp))
+					acc = accumulate(std::move(acc), comp);
 			}
 
+			return acc;
+		};
+
+		return impl::reduceRange(impl::BaseView<ComponentView, T>::mQueue, pool.getSize(), pool.getChunkSize(), identity, accumulateRange, combine, order);
+	}
+	template<typename T>
+	template<typename Result, typename Reduce, typename Transform>
+	Result ComponentView<T>::transformReduce(Result identity, Reduce&& reduce, Transform&& transform, ReduceOrder order)
+	{
+		return this->reduce(identity, [&reduce, &transform](Result acc, T& comp) {
+			return reduce(std::move(acc), transform(comp));
+		}, reduce, order);
+	}
+
+	template<typename Functor>
+	void EntityView::forEach(Functor&& func)
+	{
+		each(func);
+	}
+	template<typename Functor>
+	void EntityView::each(Functor& func)
+	{
+		auto* queue = mQueue;
+
+		auto& list = mES->entityGetList();
+
+		for (std::size_t i = 0; i < list.size(); ++i)
+		{
+			auto& entData = list[i];
+			if (entData.Destroyed)
+				continue;
+
+			Entity ent(const_cast<EntitySystem*>(mES), EntityId(static_cast<EntityId::IndexType>(i), entData.Generation));
+			if (mPred && !mPred(ent))
+				continue;
+
+			if (queue)
+				queue->submit([&func, ent]() { func(ent); });
+			else
+				func(ent);
+		}
+
 		if (queue)
 			queue->wait();
 	}
@@ -217,35 +441,47 @@ namespace Kunlaboro
 	}
 
 	template<MatchType MT, typename... Components>
-	void TypedEntityView<MT, Components...>::forEach(const Function& func)
+	template<typename Functor>
+	void TypedEntityView<MT, Components...>::forEach(Functor&& func)
 	{
-		const auto* es = impl::BaseView<TypedEntityView<MT,Components...>, Entity>::mES;
-		const auto& pred = impl::BaseView<TypedEntityView<MT,Components...>, Entity>::mPred;
-		auto* queue = impl::BaseView<TypedEntityView<MT,Components...>, Entity>::mQueue;
-
-		auto& list = es->entityGetList();
-
-		for (size_t i = 0; i < list.size(); ++i)
-		{
-			auto& entData = list[i];
-			EntityId eid(i, entData.Generation);
-
-			Entity ent = es->getEntity(eid);
-			if (es->isAlive(eid) && (!pred || pred(ent)))
-			{
-				if (queue)
-					queue->submit(Function(func), std::move(ent));
-				else
-					func(ent);
-			}
-		}
+		forEach(func, ArgumentsFor<Functor>());
+	}
+	template<MatchType MT, typename... Components>
+	void TypedEntityView<MT, Components...>::forEach(const FunctionRef& func)
+	{
+		forEach(func, EntityArguments());
+	}
 
-		if (queue)
-			queue->wait();
+	template<MatchType MT, typename... Components>
+	template<typename Functor>
+	void TypedEntityView<MT, Components...>::forEach(Functor& func, EntityArguments)
+	{
+		each([&func](Entity& ent, const EntitySystem::EntityData&) {
+			func(ent);
+		});
+	}
+	template<MatchType MT, typename... Components>
+	template<typename Functor>
+	void TypedEntityView<MT, Components...>::forEach(Functor& func, PointerArguments)
+	{
+		const auto* es = impl::BaseView<TypedEntityView<MT,Components...>, Entity>::mES;
+		each([&func, es](Entity& ent, const EntitySystem::EntityData& entData) {
+			func(ent, impl::getComponentData<Components>(*es, entData)...);
+		});
+	}
+	template<MatchType MT, typename... Components>
+	template<typename Functor>
+	void TypedEntityView<MT, Components...>::forEach(Functor& func, ReferenceArguments)
+	{
+		const auto* es = impl::BaseView<TypedEntityView<MT,Components...>, Entity>::mES;
+		each([&func, es](Entity& ent, const EntitySystem::EntityData& entData) {
+			func(ent, *impl::getComponentData<Components>(*es, entData)...);
+		});
 	}
 
 	template<MatchType MT, typename... Components>
-	void TypedEntityView<MT, Components...>::forEach(const std::function<void(const Entity&, Components*...)>& func)
+	template<typename Call>
+	void TypedEntityView<MT, Components...>::each(const Call& call)
 	{
 		const auto* es = impl::BaseView<TypedEntityView<MT,Components...>, Entity>::mES;
 		const auto& pred = impl::BaseView<TypedEntityView<MT,Components...>, Entity>::mPred;
@@ -253,21 +489,20 @@ namespace Kunlaboro
 
 		auto& list = es->entityGetList();
 
-		for (size_t i = 0; i < list.size(); ++i)
+		for (std::size_t i = 0; i < list.size(); ++i)
 		{
 			auto& entData = list[i];
-			EntityId eid(i, entData.Generation);
+			if (entData.Destroyed || !impl::matchBitfield(entData.ComponentBits, mBitField, MT))
+				continue;
 
-			Entity ent = es->getEntity(eid);
-			if (ent && (!pred || pred(ent)) && impl::matchBitfield(entData.ComponentBits, mBitField, MT))
-			{
-				if (queue)
-					queue->submit([func, ent]() {
-						func(ent, std::move(ent.getComponent<Components>().get())...);
-					});
-				else
-					func(ent, (ent.getComponent<Components>().get())...);
-			}
+			Entity ent(const_cast<EntitySystem*>(es), EntityId(static_cast<EntityId::IndexType>(i), entData.Generation));
+			if (pred && !pred(ent))
+				continue;
+
+			if (queue)
+				queue->submit([&call, &entData, ent]() mutable { call(ent, entData); });
+			else
+				call(ent, entData);
 		}
 
 		if (queue)
@@ -275,34 +510,41 @@ namespace Kunlaboro
 	}
 
 	template<MatchType MT, typename... Components>
-	void TypedEntityView<MT, Components...>::forEach(const std::function<void(const Entity&, Components&...)>& func)
+	template<typename Result, typename Accumulate, typename Combine>
+	Result TypedEntityView<MT, Components...>::reduce(Result identity, Accumulate&& accumulate, Combine&& combine, ReduceOrder order)
 	{
-		static_assert(MT == Match_All, "Can't use references unless matching all components.");
-
 		const auto* es = impl::BaseView<TypedEntityView<MT,Components...>, Entity>::mES;
 		const auto& pred = impl::BaseView<TypedEntityView<MT,Components...>, Entity>::mPred;
 		auto* queue = impl::BaseView<TypedEntityView<MT,Components...>, Entity>::mQueue;
+		const auto& bitField = mBitField;
 
 		auto& list = es->entityGetList();
 
-		for (size_t i = 0; i < list.size(); ++i)
-		{
-			auto& entData = list[i];
-			EntityId eid(i, entData.Generation);
-
-			Entity ent = es->getEntity(eid);
-			if (es->isAlive(eid) && (!pred || pred(ent)) && impl::matchBitfield(entData.ComponentBits, mBitField, MT))
+		auto accumulateRange = [es, &list, &pred, &bitField, &accumulate](Result acc, std::size_t begin, std::size_t end) {
+			for (std::size_t i = begin; i < end; ++i)
 			{
-				if (queue)
-					queue->submit([func, ent]() {
-						func(ent, std::ref(*(ent.getComponent<Components>().get()))...);
-					});
-				else
-					func(ent, *(ent.getComponent<Components>().get())...);
+				auto& entData = list[i];
+				if (entData.Destroyed || !impl::matchBitfield(entData.ComponentBits, bitField, MT))
+					continue;
+
+				Entity ent(const_cast<EntitySystem*>(es), EntityId(static_cast<EntityId::IndexType>(i), entData.Generation));
+				if (pred && !pred(ent))
+					continue;
+
+				acc = accumulate(std::move(acc), ent, impl::ComponentArgument<MT, Components>::get(impl::getComponentData<Components>(*es, entData))...);
 			}
-		}
 
-		if (queue)
-			queue->wait();
+			return acc;
+		};
+
+		return impl::reduceRange(queue, list.size(), std::size_t(sReduceChunkSize), identity, accumulateRange, combine, order);
+	}
+	template<MatchType MT, typename... Components>
+	template<typename Result, typename Reduce, typename Transform>
+	Result TypedEntityView<MT, Components...>::transformReduce(Result identity, Reduce&& reduce, Transform&& transform, ReduceOrder order)
+	{
+		return this->reduce(identity, [&reduce, &transform](Result acc, const Entity& ent, decltype(impl::ComponentArgument<MT, Components>::get(nullptr))... components) {
+			return reduce(std::move(acc), transform(ent, components...));
+		}, reduce, order);
 	}
 }
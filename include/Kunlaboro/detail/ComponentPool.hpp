@@ -1,6 +1,10 @@
 #pragma once
 
 #include <cstdint>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "DynamicBitfield.hpp"
@@ -12,26 +16,109 @@ namespace Kunlaboro
 	{
 
 		/** Acceptable performance memory pool for components
+		 *
+		 * Liveness is tracked in a two-level bitset, besides the bit for every
+		 * component there's a summary bit for every non-empty bit word and a
+		 * live count for every memory block. This lets iteration skip over
+		 * empty stretches of sparse pools without testing every slot.
 		 *
 		 * \todo Look into moving out of API, interface possibly?
 		 */
 		class BaseComponentPool
 		{
 		public:
-			BaseComponentPool(std::size_t componentSize, std::size_t chunkSize = 256);
+			/** Creates a component pool.
+			 *
+			 * \param componentSize The size of a single component.
+			 * \param chunkSize The number of components in every memory block.
+			 * \param fieldSize The combined size of all field columns per component,
+			 *                  for pools storing fields as a structure of arrays.
+			 */
+			BaseComponentPool(std::size_t componentSize, std::size_t chunkSize = 256, std::size_t fieldSize = 0);
 			virtual ~BaseComponentPool();
 
 			inline std::size_t getSize() const { return mSize; }
 			inline std::size_t getComponentSize() const { return mComponentSize; }
 			inline std::size_t getChunkSize() const { return mChunkSize; }
+			inline std::size_t getFieldSize() const { return mFieldSize; }
 
 			void ensure(std::size_t count);
 			void resize(std::size_t count, bool shrink = false);
 
 			inline bool hasBit(std::size_t index) const { return mBits.hasBit(index); }
-			inline void setBit(std::size_t index) { mBits.setBit(index); }
-			inline void resetBit(std::size_t index) { mBits.clearBit(index); }
-			inline std::size_t countBits() const { return mBits.countBits(); }
+			inline void setBit(std::size_t index)
+			{
+				if (mBits.hasBit(index))
+					return;
+
+				const auto word = index / 64;
+				if (mSummary.size() <= word / 64)
+					mSummary.resize(word / 64 + 1, 0);
+
+				mBits.setBit(index);
+				mSummary[word / 64] |= (1ull << (word % 64));
+				++mBlockCounts[index / mChunkSize];
+				++mLiveCount;
+			}
+			inline void resetBit(std::size_t index)
+			{
+				if (!mBits.hasBit(index))
+					return;
+
+				const auto word = index / 64;
+				mBits.clearBit(index);
+				if (mBits.getWords()[word] == 0)
+					mSummary[word / 64] &= ~(1ull << (word % 64));
+				--mBlockCounts[index / mChunkSize];
+				--mLiveCount;
+			}
+			/// Gets the number of live components in the pool.
+			inline std::size_t countBits() const { return mLiveCount; }
+			/// Gets the number of live components in the given memory block.
+			inline std::size_t countBlockBits(std::size_t block) const { return mBlockCounts[block]; }
+			/** Finds the first live component at or after the given index.
+			 *
+			 * \param index The index to start searching from.
+			 * \returns The index of the live component, or getSize() if there are none.
+			 */
+			inline std::size_t findNext(std::size_t index) const
+			{
+				if (index >= mSize)
+					return mSize;
+
+				const auto* words = mBits.getWords();
+				auto word = index / 64;
+
+				const auto bits = words[word] & (~0ull << (index % 64));
+				if (bits != 0)
+					return word * 64 + lowestBit(bits);
+
+				// Find the next non-empty word through the summary bits
+				++word;
+				auto summary = word / 64;
+				if (summary >= mSummary.size())
+					return mSize;
+
+				auto summaryBits = mSummary[summary] & (~0ull << (word % 64));
+				while (summaryBits == 0)
+				{
+					if (++summary >= mSummary.size())
+						return mSize;
+					summaryBits = mSummary[summary];
+				}
+
+				word = summary * 64 + lowestBit(summaryBits);
+				return word * 64 + lowestBit(words[word]);
+			}
+			/// Gets the liveness bitfield of the pool.
+			inline const DynamicBitfield& getBits() const { return mBits; }
+
+			/// Gets the number of allocated memory blocks, each holding getChunkSize() components.
+			inline std::size_t getBlockCount() const { return mBlocks.size(); }
+			/// Gets a pointer to the start of the given memory block.
+			inline void* getBlock(std::size_t block) { return mBlocks[block]; }
+			/// Gets a pointer to the start of the given memory block.
+			inline const void* getBlock(std::size_t block) const { return mBlocks[block]; }
 
 			inline void* getData(std::size_t index) {
 				return mBlocks[index / mChunkSize] + (index % mChunkSize) * mComponentSize;
@@ -43,12 +130,37 @@ namespace Kunlaboro
 
 		private:
 			std::vector<uint8_t*> mBlocks;
+			std::vector<std::uint32_t> mBlockCounts;
 			DynamicBitfield mBits;
-			std::size_t mComponentSize, mChunkSize, mSize, mCapacity;
+			std::vector<std::uint64_t> mSummary;
+			std::size_t mComponentSize, mChunkSize, mFieldSize, mSize, mCapacity, mLiveCount;
 		};
 
+		template<typename> struct VoidType { typedef void type; };
 
+		/// Checks if a component stores its fields as a structure of arrays.
+		template<typename T, typename = void>
+		struct IsSoAComponent : std::false_type { };
 		template<typename T>
+		struct IsSoAComponent<T, typename VoidType<typename T::FieldTypes>::type> : std::true_type { };
+
+		/// Calculates the combined size of a list of field types.
+		template<typename Fields>
+		struct FieldSize;
+		template<>
+		struct FieldSize<std::tuple<>> : std::integral_constant<std::size_t, 0> { };
+		template<typename F, typename... Rest>
+		struct FieldSize<std::tuple<F, Rest...>> : std::integral_constant<std::size_t, sizeof(F) + FieldSize<std::tuple<Rest...>>::value> { };
+
+		/// Calculates the per-component offset of a field column in a list of field types.
+		template<std::size_t I, typename Fields>
+		struct FieldOffset;
+		template<typename F, typename... Rest>
+		struct FieldOffset<0, std::tuple<F, Rest...>> : std::integral_constant<std::size_t, 0> { };
+		template<std::size_t I, typename F, typename... Rest>
+		struct FieldOffset<I, std::tuple<F, Rest...>> : std::integral_constant<std::size_t, sizeof(F) + FieldOffset<I - 1, std::tuple<Rest...>>::value> { };
+
+		template<typename T, bool SoA = IsSoAComponent<T>::value>
 		class ComponentPool : public BaseComponentPool
 		{
 		public:
@@ -57,12 +169,68 @@ namespace Kunlaboro
 			{ }
 			virtual ~ComponentPool() { }
 
+			/// Prepares the storage of a component before it's constructed.
+			inline void initialize(std::size_t) { }
+
 			virtual void destroy(std::size_t index) override
 			{
 				static_cast<T*>(getData(index))->~T();
 			}
 		};
 
+		/** Component pool that stores component fields as a structure of arrays.
+		 *
+		 * Every memory block holds the component objects first, followed by
+		 * one contiguous column per field type.
+		 */
+		template<typename T>
+		class ComponentPool<T, true> : public BaseComponentPool
+		{
+		public:
+			typedef typename T::FieldTypes FieldTypes;
+			template<std::size_t I>
+			using FieldType = typename std::tuple_element<I, FieldTypes>::type;
+
+			static_assert(T::sPreferredChunkSize % 64 == 0, "Structure of array components require a chunk size that's a multiple of 64.");
+
+			ComponentPool()
+				: BaseComponentPool(sizeof(T), T::sPreferredChunkSize, FieldSize<FieldTypes>::value)
+			{ }
+			virtual ~ComponentPool() { }
+
+			/// Value-initializes all fields of a component before it's constructed.
+			inline void initialize(std::size_t index)
+			{
+				initializeFields(index, std::make_index_sequence<std::tuple_size<FieldTypes>::value>());
+			}
+
+			/// Gets the column of the given field in a memory block.
+			template<std::size_t I>
+			inline FieldType<I>* getFieldColumn(std::size_t block)
+			{
+				return reinterpret_cast<FieldType<I>*>(static_cast<std::uint8_t*>(getBlock(block)) + getChunkSize() * (sizeof(T) + FieldOffset<I, FieldTypes>::value));
+			}
+			/// Gets the given field of a component.
+			template<std::size_t I>
+			inline FieldType<I>& getField(std::size_t index)
+			{
+				return getFieldColumn<I>(index / getChunkSize())[index % getChunkSize()];
+			}
+
+			virtual void destroy(std::size_t index) override
+			{
+				static_cast<T*>(getData(index))->~T();
+			}
+
+		private:
+			template<std::size_t... Is>
+			inline void initializeFields(std::size_t index, std::index_sequence<Is...>)
+			{
+				int expand[] = { 0, (new (&getField<Is>(index)) FieldType<Is>(), 0)... };
+				(void)expand;
+			}
+		};
+
 	}
 
 }
@@ -1,8 +1,8 @@
 #pragma once
 
+#include "FunctorStorage.hpp"
+
 #include <cassert>
-#include <memory>
-#include <new>
 #include <type_traits>
 #include <utility>
 
@@ -14,11 +14,21 @@ namespace detail
 
 template<typename T> class Delegate;
 
+/** Callable wrapper with inline storage for small functors.
+ *
+ * Functors that fit in store_size bytes are stored inside the delegate
+ * itself, larger ones are placed on the heap. Copies are independent,
+ * copying a delegate copies the functor it holds. Move-only functors
+ * can't be copied, so they're shared between copies instead.
+ */
 template<class R, class ...A>
 class Delegate<R(A...)>
 {
 	using stub_ptr_type = R(*)(void*, A&&...);
 
+	enum : ::std::size_t { store_size = sizeof(void*) * 4 };
+	using storage_type = FunctorStorage<store_size, true>;
+
 	Delegate(void* const o, stub_ptr_type const m) noexcept :
 	object_ptr_(o),
 		stub_ptr_(m)
@@ -27,8 +37,24 @@ class Delegate<R(A...)>
 
 public:
 	Delegate() = default;
-	Delegate(Delegate const&) = default;
-	Delegate(Delegate&&) = default;
+	Delegate(Delegate const& other)
+		: object_ptr_(other.object_ptr_)
+		, stub_ptr_(other.stub_ptr_)
+		, storage_(other.storage_)
+	{
+		if (storage_)
+			object_ptr_ = storage_.address();
+	}
+	Delegate(Delegate&& other) noexcept
+		: object_ptr_(other.object_ptr_)
+		, stub_ptr_(other.stub_ptr_)
+		, storage_(::std::move(other.storage_))
+	{
+		if (storage_)
+			object_ptr_ = storage_.address();
+
+		other.stub_ptr_ = nullptr;
+	}
 	Delegate(::std::nullptr_t const) noexcept : Delegate() { }
 
 	template<
@@ -78,21 +104,35 @@ public:
 		typename = typename ::std::enable_if<!::std::is_same<Delegate, typename ::std::decay<T>::type>{}>::type
 	>
 	Delegate(T&& f)
-		: store_(operator new(sizeof(typename ::std::decay<T>::type))
-		, functor_deleter<typename ::std::decay<T>::type>)
-		, store_size_(sizeof(typename ::std::decay<T>::type))
 	{
 		using functor_type = typename ::std::decay<T>::type;
 
-		new (store_.get()) functor_type(::std::forward<T>(f));
-
-		object_ptr_ = store_.get();
+		object_ptr_ = &storage_.template emplace<functor_type>(::std::forward<T>(f));
 		stub_ptr_ = &functor_stub<functor_type>;
-		deleter_ = &deleter_stub<functor_type>;
 	}
 
-	Delegate& operator=(Delegate const&) = default;
-	Delegate& operator=(Delegate&&) = default;
+	Delegate& operator=(Delegate const& rhs)
+	{
+		if (this != &rhs)
+			*this = Delegate(rhs);
+
+		return *this;
+	}
+	Delegate& operator=(Delegate&& rhs) noexcept
+	{
+		if (this != &rhs)
+		{
+			object_ptr_ = rhs.object_ptr_;
+			stub_ptr_ = rhs.stub_ptr_;
+			storage_ = ::std::move(rhs.storage_);
+			if (storage_)
+				object_ptr_ = storage_.address();
+
+			rhs.stub_ptr_ = nullptr;
+		}
+
+		return *this;
+	}
 
 	template<class C>
 	Delegate& operator=(R(C::* const rhs)(A...))
@@ -112,27 +152,7 @@ public:
 	>
 	Delegate& operator=(T&& f)
 	{
-		using functor_type = typename ::std::decay<T>::type;
-
-		if ((sizeof(functor_type) > store_size_) || !store_.unique())
-		{
-			store_.reset(operator new(sizeof(functor_type)),
-				functor_deleter<functor_type>);
-
-			store_size_ = sizeof(functor_type);
-		}
-		else
-		{
-			deleter_(store_.get());
-		}
-
-		new (store_.get()) functor_type(::std::forward<T>(f));
-
-		object_ptr_ = store_.get();
-		stub_ptr_ = &functor_stub<functor_type>;
-		deleter_ = &deleter_stub<functor_type>;
-
-		return *this;
+		return *this = Delegate(::std::forward<T>(f));
 	}
 
 	template<R(*const function_ptr)(A...)>
@@ -206,7 +226,11 @@ public:
 		return const_member_pair<C>(&object, method_ptr);
 	}
 
-	void reset() { stub_ptr_ = nullptr; store_.reset(); }
+	void reset()
+	{
+		storage_.reset();
+		stub_ptr_ = nullptr;
+	}
 	void reset_stub() noexcept { stub_ptr_ = nullptr; }
 
 	void swap(Delegate& other) noexcept { ::std::swap(*this, other); }
@@ -248,28 +272,10 @@ public:
 private:
 	friend struct ::std::hash<Delegate>;
 
-	using deleter_type = void(*)(void*);
-
-	void* object_ptr_;
+	void* object_ptr_{};
 	stub_ptr_type stub_ptr_{};
-	deleter_type deleter_;
-
-	::std::shared_ptr<void> store_;
-	::std::size_t store_size_;
-
-	template<class T>
-	static void functor_deleter(void* const p)
-	{
-		static_cast<T*>(p)->~T();
-
-		operator delete(p);
-	}
 
-	template<class T>
-	static void deleter_stub(void* const p)
-	{
-		static_cast<T*>(p)->~T();
-	}
+	storage_type storage_;
 
 	template<R(*function_ptr)(A...)>
 	static R function_stub(void* const, A&&... args)
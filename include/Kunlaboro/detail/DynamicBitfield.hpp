@@ -1,15 +1,57 @@
 #pragma once 
 
 #include <vector>
-#include <cmath>
 #include <cstdint>
 
+#if defined _MSC_VER
+#include <intrin.h>
+#endif
+
 namespace Kunlaboro
 {
 
 	namespace detail
 	{
 
+		/// Gets the index of the lowest set bit in a word, the word must not be zero.
+		inline unsigned lowestBit(std::uint64_t word)
+		{
+#if defined _MSC_VER
+			unsigned long index;
+			_BitScanForward64(&index, word);
+			return static_cast<unsigned>(index);
+#elif defined __GNUC__
+			return static_cast<unsigned>(__builtin_ctzll(word));
+#else
+			unsigned index = 0;
+			while ((word & 1) == 0)
+			{
+				word >>= 1;
+				++index;
+			}
+			return index;
+#endif
+		}
+		/// Gets the index of the highest set bit in a word, the word must not be zero.
+		inline unsigned highestBit(std::uint64_t word)
+		{
+#if defined _MSC_VER
+			unsigned long index;
+			_BitScanReverse64(&index, word);
+			return static_cast<unsigned>(index);
+#elif defined __GNUC__
+			return 63 - static_cast<unsigned>(__builtin_clzll(word));
+#else
+			unsigned index = 63;
+			while ((word & (1ull << 63)) == 0)
+			{
+				word <<= 1;
+				--index;
+			}
+			return index;
+#endif
+		}
+
 		/** Dynamic size bitfield.
 		 *
 		 * \todo Look into moving out of API.
@@ -26,38 +68,53 @@ namespace Kunlaboro
 			inline void ensure(std::size_t bit)
 			{
 				const auto count = bit + 1;
-				const std::size_t bytes = static_cast<std::size_t>(std::ceil(count / 64.f));
+				const std::size_t words = (count + 63) / 64;
 
-				if (mCapacity < bytes)
+				if (mCapacity < words)
 				{
-					mBits.resize(bytes, 0);
-					mCapacity = bytes;
+					mBits.resize(words, 0);
+					mCapacity = words;
 				}
 
 				if (mSize < count)
 					mSize = count;
 			}
+			/// Shrinks the size down to the highest set bit, skipping over whole empty words.
 			inline void shrink()
 			{
-				// TODO: Shrink size properly
-				while (mSize > 0 && !hasBit(mSize - 1))
-					--mSize;
+				auto word = (mSize + 63) / 64;
+				while (word > 0 && mBits[word - 1] == 0)
+					--word;
+
+				mSize = (word > 0 ? (word - 1) * 64 + highestBit(mBits[word - 1]) + 1 : 0);
 			}
 
+			/** Gets the size of the bitfield.
+			 *
+			 * This is a high-water mark, one past the highest bit that has been set or
+			 * ensured. Clearing bits doesn't lower it, call shrink() for a tight size.
+			 */
 			inline std::size_t getSize() const { return mSize; }
 			std::size_t countBits() const;
 
+			/// Gets the underlying bit words, 64 bits per word.
+			inline const std::uint64_t* getWords() const { return mBits.data(); }
+			/// Gets the number of allocated bit words.
+			inline std::size_t getWordCount() const { return mCapacity; }
+
+			/// Checks if the two bitfields have any set bits in common.
+			bool intersects(const DynamicBitfield& rhs) const;
+
 			bool operator==(const DynamicBitfield& rhs) const;
 			bool operator!=(const DynamicBitfield& rhs) const;
 
 			inline bool hasBit(std::size_t bit) const { return mSize > bit && (mBits[bit / 64] & (1ull << (bit % 64))) != 0; }
 			inline void setBit(std::size_t bit) { ensure(bit); mBits[bit / 64] |= (1ull << (bit % 64)); }
 			inline void clearBit(std::size_t bit) {
-				if (mSize < bit)
+				if (mSize <= bit)
 					return;
 
 				mBits[bit / 64] &= ~(1ull << (bit % 64));
-				shrink();
 			}
 
 		private:
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <type_traits>
+#include <utility>
+
+namespace Kunlaboro
+{
+
+	namespace detail
+	{
+
+		template<typename T> class FunctionRef;
+
+		/** Non-owning reference to a callable.
+		 *
+		 * Only stores a pointer to the callable and a function to call it
+		 * with, so it never allocates and is trivially copyable.
+		 *
+		 * \code{.cpp}
+		 * void each(FunctionRef<void(int)> func);
+		 * each([&sum](int value) { sum += value; });
+		 * \endcode
+		 *
+		 * \note The referenced callable must outlive the reference, which
+		 *       makes it suited for function parameters but not for storage.
+		 */
+		template<typename R, typename... Args>
+		class FunctionRef<R(Args...)>
+		{
+			typedef R(*CallbackFunc)(void* object, Args... args);
+
+		public:
+			template<typename Functor, typename = typename std::enable_if<!std::is_same<typename std::decay<Functor>::type, FunctionRef>::value>::type>
+			FunctionRef(Functor&& func) noexcept
+				: mObject(const_cast<void*>(static_cast<const void*>(std::addressof(func))))
+				, mCallback(&call<typename std::remove_reference<Functor>::type>)
+			{ }
+			FunctionRef(const FunctionRef&) = default;
+
+			FunctionRef& operator=(const FunctionRef&) = default;
+
+			inline R operator()(Args... args) const
+			{
+				return mCallback(mObject, std::forward<Args>(args)...);
+			}
+
+		private:
+			template<typename Functor>
+			static R call(void* object, Args... args)
+			{
+				return (*static_cast<Functor*>(object))(std::forward<Args>(args)...);
+			}
+
+			void* mObject;
+			CallbackFunc mCallback;
+		};
+
+	}
+
+}
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace Kunlaboro
+{
+
+	namespace detail
+	{
+
+		/** Owning, type-erased storage for a functor.
+		 *
+		 * Functors that fit in Size bytes are stored inline, larger ones are
+		 * placed on the heap. Where a functor is stored is decided from its
+		 * type alone, so reading it back with get() never branches.
+		 *
+		 * Calling the functor is left to the owner of the storage, which knows
+		 * the signature, by way of a stub that reads it back with get().
+		 *
+		 * \tparam Size The largest functor that can be stored without allocating.
+		 * \tparam Copyable Should the storage be copyable, copying the functor
+		 *                  it holds. Functors that can't be copied are shared
+		 *                  between copies instead.
+		 */
+		template<std::size_t Size, bool Copyable = false>
+		class FunctorStorage
+		{
+			enum ManageOp
+			{
+				Manage_Copy,
+				Manage_Move,
+				Manage_Destroy,
+				Manage_Address
+			};
+			/// Copies or moves the functor from the source into the target, destroys it, or gets its address.
+			typedef void*(*ManageFunc)(ManageOp op, FunctorStorage* source, FunctorStorage* target);
+
+			typedef std::integral_constant<int, 0> InlineStorage;
+			typedef std::integral_constant<int, 1> HeapStorage;
+			typedef std::integral_constant<int, 2> SharedStorage;
+
+			template<typename T>
+			using FitsInline = std::integral_constant<bool,
+				sizeof(T) <= Size && alignof(T) <= alignof(void*) && std::is_nothrow_move_constructible<T>::value>;
+			template<typename T>
+			using StorageFor = typename std::conditional<Copyable && !std::is_copy_constructible<T>::value, SharedStorage,
+				typename std::conditional<FitsInline<T>::value, InlineStorage, HeapStorage>::type>::type;
+
+		public:
+			FunctorStorage() noexcept
+				: mManage(nullptr)
+			{ }
+			FunctorStorage(const FunctorStorage& copy)
+				: mManage(nullptr)
+			{
+				static_assert(Copyable, "The functor storage is not copyable.");
+
+				if (copy.mManage)
+					copy.mManage(Manage_Copy, const_cast<FunctorStorage*>(&copy), this);
+				mManage = copy.mManage;
+			}
+			FunctorStorage(FunctorStorage&& move) noexcept
+				: mManage(move.mManage)
+			{
+				if (mManage)
+					mManage(Manage_Move, &move, this);
+				move.mManage = nullptr;
+			}
+			~FunctorStorage()
+			{
+				reset();
+			}
+
+			FunctorStorage& operator=(const FunctorStorage& copy)
+			{
+				if (this != &copy)
+					*this = FunctorStorage(copy);
+				return *this;
+			}
+			FunctorStorage& operator=(FunctorStorage&& move) noexcept
+			{
+				if (this == &move)
+					return *this;
+
+				reset();
+
+				mManage = move.mManage;
+				if (mManage)
+					mManage(Manage_Move, &move, this);
+				move.mManage = nullptr;
+				return *this;
+			}
+
+			/** Stores a functor, destroying the one held before.
+			 *
+			 * \tparam T The type of the functor to store.
+			 * \returns The stored functor.
+			 */
+			template<typename T, typename Functor>
+			T& emplace(Functor&& func)
+			{
+				reset();
+				store<T>(std::forward<Functor>(func), StorageFor<T>());
+				mManage = &manage<T>;
+				return get<T>();
+			}
+			/** Gets the stored functor.
+			 *
+			 * \tparam T The type of the functor, must match the one given to emplace().
+			 */
+			template<typename T>
+			inline T& get() const { return get<T>(StorageFor<T>()); }
+			/// Gets the address of the stored functor, for when its type isn't known.
+			void* address() const { return (mManage ? mManage(Manage_Address, const_cast<FunctorStorage*>(this), nullptr) : nullptr); }
+
+			/// Destroys the stored functor.
+			void reset() noexcept
+			{
+				if (mManage)
+					mManage(Manage_Destroy, this, nullptr);
+				mManage = nullptr;
+			}
+
+			explicit operator bool() const noexcept { return mManage != nullptr; }
+
+		private:
+			template<typename T, typename Functor>
+			void store(Functor&& func, InlineStorage) { new (&mStorage) T(std::forward<Functor>(func)); }
+			template<typename T, typename Functor>
+			void store(Functor&& func, HeapStorage) { *reinterpret_cast<T**>(&mStorage) = new T(std::forward<Functor>(func)); }
+			template<typename T, typename Functor>
+			void store(Functor&& func, SharedStorage) { new (&mStorage) std::shared_ptr<T>(std::make_shared<T>(std::forward<Functor>(func))); }
+
+			template<typename T>
+			inline T& get(InlineStorage) const { return *reinterpret_cast<T*>(const_cast<StorageType*>(&mStorage)); }
+			template<typename T>
+			inline T& get(HeapStorage) const { return **reinterpret_cast<T* const*>(&mStorage); }
+			template<typename T>
+			inline T& get(SharedStorage) const { return *reinterpret_cast<const std::shared_ptr<T>*>(&mStorage)->get(); }
+
+			template<typename T>
+			static void* manage(ManageOp op, FunctorStorage* source, FunctorStorage* target)
+			{
+				return manage<T>(op, source, target, StorageFor<T>());
+			}
+			template<typename T>
+			static void* manage(ManageOp op, FunctorStorage* source, FunctorStorage* target, InlineStorage)
+			{
+				auto* functor = &source->get<T>();
+				switch (op)
+				{
+				case Manage_Copy:
+					clone<T>(*functor, target, std::integral_constant<bool, Copyable>());
+					break;
+
+				case Manage_Move:
+					new (&target->mStorage) T(std::move(*functor));
+					functor->~T();
+					break;
+
+				case Manage_Destroy:
+					functor->~T();
+					break;
+
+				case Manage_Address:
+					return functor;
+				}
+				return nullptr;
+			}
+			template<typename T>
+			static void* manage(ManageOp op, FunctorStorage* source, FunctorStorage* target, HeapStorage)
+			{
+				auto* functor = &source->get<T>();
+				switch (op)
+				{
+				case Manage_Copy:
+					*reinterpret_cast<T**>(&target->mStorage) = clone<T>(*functor, std::integral_constant<bool, Copyable>());
+					break;
+
+				case Manage_Move:
+					// The target takes over the pointer
+					*reinterpret_cast<T**>(&target->mStorage) = functor;
+					break;
+
+				case Manage_Destroy:
+					delete functor;
+					break;
+
+				case Manage_Address:
+					return functor;
+				}
+				return nullptr;
+			}
+			template<typename T>
+			static void* manage(ManageOp op, FunctorStorage* source, FunctorStorage* target, SharedStorage)
+			{
+				auto* shared = reinterpret_cast<std::shared_ptr<T>*>(&source->mStorage);
+				switch (op)
+				{
+				case Manage_Copy:
+					new (&target->mStorage) std::shared_ptr<T>(*shared);
+					break;
+
+				case Manage_Move:
+					new (&target->mStorage) std::shared_ptr<T>(std::move(*shared));
+					shared->~shared_ptr();
+					break;
+
+				case Manage_Destroy:
+					shared->~shared_ptr();
+					break;
+
+				case Manage_Address:
+					return shared->get();
+				}
+				return nullptr;
+			}
+
+			// Only instantiated for copyable functors in copyable storage
+			template<typename T>
+			static void clone(const T& functor, FunctorStorage* target, std::true_type) { new (&target->mStorage) T(functor); }
+			template<typename T>
+			static T* clone(const T& functor, std::true_type) { return new T(functor); }
+			template<typename T>
+			static void clone(const T&, FunctorStorage*, std::false_type) { }
+			template<typename T>
+			static T* clone(const T&, std::false_type) { return nullptr; }
+
+			typedef typename std::aligned_storage<Size, alignof(void*)>::type StorageType;
+			static_assert(!Copyable || sizeof(std::shared_ptr<void>) <= Size, "Copyable functor storage must be able to hold a shared functor.");
+
+			ManageFunc mManage;
+			StorageType mStorage;
+		};
+
+	}
+
+}
@@ -1,11 +1,13 @@
 #pragma once
 
 #include "Delegate.hpp"
+#include "WorkStealingDeque.hpp"
 
 #include <atomic>
-#include <chrono>
-#include <deque>
 #include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <vector>
 
@@ -17,9 +19,19 @@ namespace Kunlaboro
 	namespace detail
 	{
 
-		/** Threaded job queue.
+		/** Threaded work-stealing job queue.
+		 *
+		 * Every worker thread owns a lock-free deque of jobs, jobs submitted
+		 * from inside a running job go straight into the deque of the worker
+		 * running it. Jobs submitted from outside of the queue are placed in
+		 * a shared injection deque, which the workers steal from.
+		 *
+		 * Idle workers will steal from the other workers before going to sleep.
+		 *
+		 * Finished job records are kept for reuse, so once the queue is warmed
+		 * up submitting a job doesn't allocate, as long as the functor fits in
+		 * the inline storage of a Delegate.
 		 *
-		 * \todo Improve performance when repeatedly launching and waiting for job groups.
 		 * \todo Look into moving out of API.
 		 */
 		class JobQueue
@@ -31,9 +43,22 @@ namespace Kunlaboro
 			JobQueue(const JobQueue&) = delete;
 			~JobQueue();
 
+			/** Stops all worker threads, discarding any unfinished jobs.
+			 */
 			void abort();
+			/** Starts the worker threads after a stop or abort.
+			 */
 			void start();
+			/** Stops all worker threads once all submitted jobs are finished.
+			 */
 			void stop();
+			/** Waits for submitted jobs to finish, helping out with the work meanwhile.
+			 *
+			 * When called from inside a running job, this will only wait for
+			 * the jobs that have been submitted from within that job.
+			 *
+			 * \param restart Should the worker threads keep running after the wait.
+			 */
 			void wait(bool restart = true);
 
 			template<typename Functor, typename... Args>
@@ -41,15 +66,57 @@ namespace Kunlaboro
 			template<typename Functor>
 			void submit(Functor&& functor);
 
+			/// Gets the number of worker threads in the queue.
+			inline std::size_t getThreadCount() const { return mWorkers.size(); }
+
 		private:
-			void workThread();
+			struct Job
+			{
+				Delegate<void()> Work;
+				Job* Parent;
+				std::atomic<std::uint32_t> Unfinished;
+				/// The worker that submitted the job, which takes the record back once it's done.
+				std::size_t Owner;
+			};
+			struct Worker
+			{
+				WorkStealingDeque<Job*> Jobs;
+				/// Finished job records, only touched by the worker thread.
+				std::vector<Job*> FreeJobs;
+				std::thread Thread;
+			};
+
+			/// Takes a finished job record for reuse, or allocates a new one.
+			Job* allocate();
+			/// Keeps a finished job record around for reuse.
+			void release(Job* job);
+			void push(Job* job);
+			Job* findJob(std::size_t worker);
+			void execute(Job* job);
+			void finish(Job* job);
+
+			void workThread(std::size_t index);
+			void wakeAll();
+			void startAll();
 			void joinAll();
 
-			std::deque<Delegate<void()>> mJobQueue;
-			std::vector<std::thread> mThreadPool;
-			std::mutex mMutex;
+			static thread_local const JobQueue* sWorkerQueue;
+			static thread_local std::size_t sWorkerIndex;
+			static thread_local const JobQueue* sJobQueue;
+			static thread_local Job* sCurrentJob;
+
+			std::vector<std::unique_ptr<Worker>> mWorkers;
+			WorkStealingDeque<Job*> mInjected;
+			std::mutex mInjectMutex;
+			/// Finished job records that any thread can take, guarded by mFreeMutex.
+			std::vector<Job*> mFreeJobs;
+			std::mutex mFreeMutex;
+
+			std::mutex mSleepMutex;
 			std::condition_variable mSignal;
+			std::atomic<std::uint32_t> mSleeping;
 
+			std::atomic<std::size_t> mPending;
 			std::atomic_bool mExiting
 			               , mCompleteWork;
 		};
@@ -57,25 +124,17 @@ namespace Kunlaboro
 		template<typename Functor, typename... Args>
 		void JobQueue::submit(Functor&& functor, Args&&... args)
 		{
-			assert(!mExiting);
-
-			{
-				std::lock_guard<std::mutex> lock(mMutex);
-				mJobQueue.emplace_back(std::bind(std::forward<Functor>(functor), std::forward<Args>(args)...));
-			}
-			mSignal.notify_one();
+			submit(std::bind(std::forward<Functor>(functor), std::forward<Args>(args)...));
 		}
-		
+
 		template<typename Functor>
 		void JobQueue::submit(Functor&& functor)
 		{
-			assert(!mExiting);
+			assert(!mExiting || mCompleteWork);
 
-			{
-				std::lock_guard<std::mutex> lock(mMutex);
-				mJobQueue.emplace_back(std::forward<Functor>(functor));
-			}
-			mSignal.notify_one();
+			auto* job = allocate();
+			job->Work = std::forward<Functor>(functor);
+			push(job);
 		}
 
 	}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace Kunlaboro
+{
+
+	namespace detail
+	{
+
+		/** Bounded lock-free multi-producer single-consumer queue.
+		 *
+		 * Any number of threads can push values into the queue, while a
+		 * single owning thread pops them. Every slot carries a sequence
+		 * number that tells producers and the consumer whose turn it is,
+		 * so neither end takes a lock.
+		 *
+		 * Based on the bounded MPMC queue by Dmitry Vyukov.
+		 *
+		 * \tparam T The stored type.
+		 * \note The capacity is fixed at construction, pushing to a full
+		 *       queue fails instead of allocating.
+		 */
+		template<typename T>
+		class MPSCQueue
+		{
+			struct Cell
+			{
+				std::atomic<std::size_t> Sequence;
+				typename std::aligned_storage<sizeof(T), alignof(T)>::type Storage;
+			};
+
+		public:
+			/** Creates a queue with room for the given number of values.
+			 *
+			 * \param capacity The capacity, rounded up to a power of two.
+			 */
+			MPSCQueue(std::size_t capacity)
+				: mDequeue(0)
+				, mEnqueue(0)
+			{
+				std::size_t size = 2;
+				while (size < capacity)
+					size *= 2;
+
+				mMask = size - 1;
+				mCells.reset(new Cell[size]);
+				for (std::size_t i = 0; i < size; ++i)
+					mCells[i].Sequence.store(i, std::memory_order_relaxed);
+			}
+			MPSCQueue(const MPSCQueue&) = delete;
+			~MPSCQueue()
+			{
+				while (pop([](T&) { }))
+					;
+			}
+
+			MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+			/** Constructs a value at the end of the queue.
+			 *
+			 * Can be called from any thread.
+			 *
+			 * \param args The arguments to construct the value with.
+			 * \returns If the value was pushed, false when the queue is full.
+			 */
+			template<typename... Args>
+			bool push(Args&&... args)
+			{
+				auto pos = mEnqueue.load(std::memory_order_relaxed);
+				while (true)
+				{
+					auto& cell = mCells[pos & mMask];
+					const auto sequence = cell.Sequence.load(std::memory_order_acquire);
+					const auto diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+
+					if (diff == 0)
+					{
+						if (mEnqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						{
+							new (&cell.Storage) T(std::forward<Args>(args)...);
+							cell.Sequence.store(pos + 1, std::memory_order_release);
+							return true;
+						}
+					}
+					else if (diff < 0)
+						return false;
+					else
+						pos = mEnqueue.load(std::memory_order_relaxed);
+				}
+			}
+			/** Pops a value from the front of the queue.
+			 *
+			 * The slot is released before the consumer is called, so the
+			 * consumer may push into the queue again.
+			 *
+			 * \param consume The functor to pass the popped value to.
+			 * \returns If a value was popped.
+			 * \note Must only be called by the owning thread.
+			 */
+			template<typename Functor>
+			bool pop(Functor&& consume)
+			{
+				auto& cell = mCells[mDequeue & mMask];
+				const auto sequence = cell.Sequence.load(std::memory_order_acquire);
+				if (static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(mDequeue + 1) < 0)
+					return false;
+
+				auto* stored = reinterpret_cast<T*>(&cell.Storage);
+				T value(std::move(*stored));
+				stored->~T();
+
+				cell.Sequence.store(mDequeue + mMask + 1, std::memory_order_release);
+				++mDequeue;
+
+				consume(value);
+				return true;
+			}
+
+			/// Gets the number of values the queue can hold.
+			inline std::size_t getCapacity() const { return mMask + 1; }
+
+		private:
+			enum { sCacheLine = 64 };
+
+			std::unique_ptr<Cell[]> mCells;
+			std::size_t mMask;
+
+			// Padded onto separate cache lines, the consumer and producers write to them
+			char mPad0[sCacheLine];
+			std::size_t mDequeue;
+			char mPad1[sCacheLine - sizeof(std::size_t)];
+			std::atomic<std::size_t> mEnqueue;
+			char mPad2[sCacheLine - sizeof(std::size_t)];
+		};
+
+	}
+
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace Kunlaboro
+{
+
+	namespace detail
+	{
+
+		/** Lock-free Chase-Lev work-stealing deque.
+		 *
+		 * The owning thread pushes and pops at the bottom end of the deque,
+		 * while any number of other threads can steal from the top end.
+		 * Neither end takes a lock, contention only happens when the owner
+		 * and a thief race for the very last element.
+		 *
+		 * Based on "Correct and Efficient Work-Stealing for Weak Memory Models"
+		 * by Lê, Pop, Cohen, and Zappa Nardelli.
+		 *
+		 * \tparam T The stored type, must be a pointer.
+		 * \note Retired buffers are kept alive until the deque is destroyed,
+		 *       since a thief might still be reading from one.
+		 */
+		template<typename T>
+		class WorkStealingDeque
+		{
+			static_assert(std::is_pointer<T>::value, "Work-stealing deques only store pointers.");
+
+			struct Buffer
+			{
+				Buffer(std::int64_t capacity)
+					: Capacity(capacity)
+					, Mask(capacity - 1)
+					, Data(new std::atomic<T>[static_cast<std::size_t>(capacity)])
+				{ }
+
+				inline T get(std::int64_t index) const { return Data[index & Mask].load(std::memory_order_relaxed); }
+				inline void put(std::int64_t index, T value) { Data[index & Mask].store(value, std::memory_order_relaxed); }
+
+				std::int64_t Capacity, Mask;
+				std::unique_ptr<std::atomic<T>[]> Data;
+			};
+
+		public:
+			WorkStealingDeque(std::int64_t capacity = 1024)
+				: mTop(0)
+				, mBottom(0)
+			{
+				mBuffers.emplace_back(new Buffer(capacity));
+				mBuffer.store(mBuffers.back().get(), std::memory_order_relaxed);
+			}
+			WorkStealingDeque(const WorkStealingDeque&) = delete;
+			~WorkStealingDeque() = default;
+
+			WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+			/** Pushes a value onto the bottom of the deque.
+			 *
+			 * \note Must only be called by the owning thread.
+			 */
+			void push(T value)
+			{
+				const auto bottom = mBottom.load(std::memory_order_relaxed);
+				const auto top = mTop.load(std::memory_order_acquire);
+				auto* buffer = mBuffer.load(std::memory_order_relaxed);
+
+				if (bottom - top > buffer->Capacity - 1)
+					buffer = grow(buffer, bottom, top);
+
+				buffer->put(bottom, value);
+				mBottom.store(bottom + 1, std::memory_order_release);
+			}
+			/** Pops a value from the bottom of the deque.
+			 *
+			 * \note Must only be called by the owning thread.
+			 * \returns The popped value, or nullptr if the deque was empty.
+			 */
+			T pop()
+			{
+				const auto bottom = mBottom.load(std::memory_order_relaxed) - 1;
+				auto* buffer = mBuffer.load(std::memory_order_relaxed);
+				mBottom.store(bottom, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				auto top = mTop.load(std::memory_order_relaxed);
+
+				if (top > bottom)
+				{
+					mBottom.store(bottom + 1, std::memory_order_relaxed);
+					return nullptr;
+				}
+
+				T value = buffer->get(bottom);
+				if (top == bottom)
+				{
+					// Racing thieves for the last element
+					if (!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+						value = nullptr;
+					mBottom.store(bottom + 1, std::memory_order_relaxed);
+				}
+
+				return value;
+			}
+			/** Steals a value from the top of the deque.
+			 *
+			 * Can be called from any thread.
+			 *
+			 * \returns The stolen value, or nullptr if the deque was empty
+			 *          or another thread won the race for the value.
+			 */
+			T steal()
+			{
+				auto top = mTop.load(std::memory_order_acquire);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				const auto bottom = mBottom.load(std::memory_order_acquire);
+
+				if (top >= bottom)
+					return nullptr;
+
+				auto* buffer = mBuffer.load(std::memory_order_acquire);
+				T value = buffer->get(top);
+				if (!mTop.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+					return nullptr;
+
+				return value;
+			}
+
+			/// Checks if the deque is empty, the result is only a snapshot.
+			inline bool empty() const
+			{
+				return mBottom.load(std::memory_order_relaxed) <= mTop.load(std::memory_order_relaxed);
+			}
+
+		private:
+			Buffer* grow(Buffer* old, std::int64_t bottom, std::int64_t top)
+			{
+				auto* buffer = new Buffer(old->Capacity * 2);
+				for (auto i = top; i < bottom; ++i)
+					buffer->put(i, old->get(i));
+
+				mBuffers.emplace_back(buffer);
+				mBuffer.store(buffer, std::memory_order_release);
+				return buffer;
+			}
+
+			std::atomic<std::int64_t> mTop, mBottom;
+			std::atomic<Buffer*> mBuffer;
+			std::vector<std::unique_ptr<Buffer>> mBuffers;
+		};
+
+	}
+
+}
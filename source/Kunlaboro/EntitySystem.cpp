@@ -10,12 +10,26 @@
 #include <Kunlaboro/detail/ComponentPool.hpp>
 
 #include <cassert>
+#include <utility>
 
 using namespace Kunlaboro;
 
+namespace
+{
+	/// Gives the capacity of a flushed batch record back to the entity system.
+	template<typename T>
+	void recycle(std::vector<T>& record, std::vector<T>& flushed)
+	{
+		flushed.clear();
+		if (record.empty())
+			record.swap(flushed);
+	}
+}
+
 EntitySystem::EntitySystem()
 	: mEventSystem(nullptr)
 	, mMessageSystem(nullptr)
+	, mBatchDepth(0)
 {
 
 }
@@ -64,7 +78,19 @@ Entity EntitySystem::createEntity()
 	ent.Destroyed = false;
 	auto eid = EntityId(id, ent.Generation);
 	if (mEventSystem)
-		mEventSystem->emitEvent<EntityCreatedEvent>(eid, this);
+	{
+		if (mBatchDepth > 0)
+		{
+			mCreatedEntities.push_back(eid);
+			mBatchOrder.push_back(sBatchedCreate);
+		}
+		else
+		{
+			mEventSystem->emitEvent<EntityCreatedEvent>(eid, this);
+			if (mEventSystem->hasListeners<EntitiesCreatedEvent>())
+				mEventSystem->emitEvent<EntitiesCreatedEvent>(&eid, std::size_t(1), this);
+		}
+	}
 
 	return Entity(this, eid);
 }
@@ -88,7 +114,19 @@ void EntitySystem::destroyEntity(EntityId id)
 	mFreeEntityIndices.push_back(id.getIndex());
 
 	if (mEventSystem)
-		mEventSystem->emitEvent<EntityDestroyedEvent>(id, this);
+	{
+		if (mBatchDepth > 0)
+		{
+			mDestroyedEntities.push_back(id);
+			mBatchOrder.push_back(sBatchedDestroy);
+		}
+		else
+		{
+			mEventSystem->emitEvent<EntityDestroyedEvent>(id, this);
+			if (mEventSystem->hasListeners<EntitiesDestroyedEvent>())
+				mEventSystem->emitEvent<EntitiesDestroyedEvent>(&id, std::size_t(1), this);
+		}
+	}
 }
 
 bool EntitySystem::isAlive(EntityId id) const
@@ -132,16 +170,9 @@ void EntitySystem::destroyComponent(ComponentId id)
 	if (!data.MemoryPool->hasBit(id.getIndex()))
 		return;
 
-	EntityId::IndexType eid = 0;
-	for (auto& ent : mEntities)
-	{
-		if (ent.ComponentBits.hasBit(id.getFamily()) && ent.Components[id.getFamily()] == id)
-		{
-			detachComponent(id, EntityId(eid, ent.Generation));
-			break;
-		}
-		++eid;
-	}
+	const auto eid = data.Components[id.getIndex()].Entity;
+	if (eid != EntityId::Invalid())
+		detachComponent(id, eid);
 
 	if (mEventSystem)
 		mEventSystem->unregisterAllEvents(id);
@@ -157,7 +188,19 @@ void EntitySystem::destroyComponent(ComponentId id)
 	data.FreeIndices.push_back(id.getIndex());
 
 	if (mEventSystem)
-		mEventSystem->emitEvent<ComponentDestroyedEvent>(id, this);
+	{
+		if (mBatchDepth > 0)
+		{
+			mDestroyedComponents.push_back(id);
+			mBatchOrder.push_back(sBatchedDestroyComponent);
+		}
+		else
+		{
+			mEventSystem->emitEvent<ComponentDestroyedEvent>(id, this);
+			if (mEventSystem->hasListeners<ComponentsDestroyedEvent>())
+				mEventSystem->emitEvent<ComponentsDestroyedEvent>(&id, std::size_t(1), this);
+		}
+	}
 }
 inline bool EntitySystem::isAlive(ComponentId id) const
 {
@@ -195,11 +238,12 @@ void EntitySystem::attachComponent(ComponentId cid, EntityId eid, bool checkDeta
 	if (checkDetach)
 	{
 		auto comp = getComponent(cid);
-		if (comp->getEntityId() == eid)
+		const auto current = getEntity(cid);
+		if (current == eid)
 			return;
 
-		if (getEntity(cid) != EntityId())
-			detachComponent(cid, comp->getEntityId());
+		if (current != EntityId::Invalid())
+			detachComponent(cid, current);
 
 		if (entity.Components[cid.getFamily()] != ComponentId::Invalid())
 			detachComponent(entity.Components[cid.getFamily()], eid);
@@ -210,8 +254,25 @@ void EntitySystem::attachComponent(ComponentId cid, EntityId eid, bool checkDeta
 	entity.ComponentBits.setBit(cid.getFamily());
 	entity.Components[cid.getFamily()] = cid;
 
+	auto& family = mComponentFamilies[cid.getFamily()];
+	family.Components[cid.getIndex()].Entity = eid;
+	static_cast<Component*>(family.MemoryPool->getData(cid.getIndex()))->onAttached(eid);
+
 	if (mEventSystem)
-		mEventSystem->emitEvent<ComponentAttachedEvent>(cid, eid, this);
+	{
+		if (mBatchDepth > 0)
+		{
+			mAttachedComponents.push_back(cid);
+			mAttachedEntities.push_back(eid);
+			mBatchOrder.push_back(sBatchedAttach);
+		}
+		else
+		{
+			mEventSystem->emitEvent<ComponentAttachedEvent>(cid, eid, this);
+			if (mEventSystem->hasListeners<ComponentsAttachedEvent>())
+				mEventSystem->emitEvent<ComponentsAttachedEvent>(&cid, &eid, std::size_t(1), this);
+		}
+	}
 }
 void EntitySystem::detachComponent(ComponentId cid, EntityId eid)
 {
@@ -222,33 +283,41 @@ void EntitySystem::detachComponent(ComponentId cid, EntityId eid)
 	if (entity.Components.size() <= cid.getFamily())
 		return;
 
-	auto comp = getComponent(cid);
-	if (comp->getEntityId() != eid)
+	auto& family = mComponentFamilies[cid.getFamily()];
+	if (family.Components[cid.getIndex()].Entity != eid)
 		return;
 
+	auto comp = getComponent(cid);
 	entity.ComponentBits.clearBit(cid.getFamily());
 	entity.Components[cid.getFamily()] = ComponentId::Invalid();
 
+	family.Components[cid.getIndex()].Entity = EntityId::Invalid();
+	comp->onDetached(eid);
+
 	if (mEventSystem)
-		mEventSystem->emitEvent<ComponentDetachedEvent>(cid, eid, this);
+	{
+		if (mBatchDepth > 0)
+		{
+			mDetachedComponents.push_back(cid);
+			mDetachedEntities.push_back(eid);
+			mBatchOrder.push_back(sBatchedDetach);
+		}
+		else
+		{
+			mEventSystem->emitEvent<ComponentDetachedEvent>(cid, eid, this);
+			if (mEventSystem->hasListeners<ComponentsDetachedEvent>())
+				mEventSystem->emitEvent<ComponentsDetachedEvent>(&cid, &eid, std::size_t(1), this);
+		}
+	}
 
 	comp.release();
 }
 EntityId EntitySystem::getEntity(ComponentId cid) const
 {
 	if (!isAlive(cid))
-		return EntityId();
-
-	EntityId::IndexType i = 0;
-	for (auto& ent : mEntities)
-	{
-		if (ent.ComponentBits.hasBit(cid.getFamily()) && ent.Components[cid.getFamily()] == cid)
-			return EntityId(i, ent.Generation);
+		return EntityId::Invalid();
 
-		++i;
-	}
-
-	return EntityId();
+	return mComponentFamilies[cid.getFamily()].Components[cid.getIndex()].Entity;
 }
 
 const detail::BaseComponentPool& EntitySystem::componentGetPool(ComponentId::FamilyType family) const
@@ -287,6 +356,90 @@ const MessageSystem& EntitySystem::getMessageSystem() const
 	return *mMessageSystem;
 }
 
+void EntitySystem::beginBatch()
+{
+	++mBatchDepth;
+}
+void EntitySystem::endBatch()
+{
+	assert(mBatchDepth > 0);
+	if (--mBatchDepth > 0 || !mEventSystem)
+		return;
+
+	// Listeners may cause new changes, which are emitted directly now that the batch is over
+	auto created = std::move(mCreatedEntities);
+	auto attached = std::move(mAttachedComponents);
+	auto attachedTo = std::move(mAttachedEntities);
+	auto detached = std::move(mDetachedComponents);
+	auto detachedFrom = std::move(mDetachedEntities);
+	auto destroyedComponents = std::move(mDestroyedComponents);
+	auto destroyed = std::move(mDestroyedEntities);
+	auto order = std::move(mBatchOrder);
+
+	if (!created.empty())
+		mEventSystem->emitEvent<EntitiesCreatedEvent>(created.data(), created.size(), this);
+	if (!attached.empty())
+		mEventSystem->emitEvent<ComponentsAttachedEvent>(attached.data(), attachedTo.data(), attached.size(), this);
+	if (!detached.empty())
+		mEventSystem->emitEvent<ComponentsDetachedEvent>(detached.data(), detachedFrom.data(), detached.size(), this);
+	if (!destroyedComponents.empty())
+		mEventSystem->emitEvent<ComponentsDestroyedEvent>(destroyedComponents.data(), destroyedComponents.size(), this);
+	if (!destroyed.empty())
+		mEventSystem->emitEvent<EntitiesDestroyedEvent>(destroyed.data(), destroyed.size(), this);
+
+	const bool singleCreate = mEventSystem->hasListeners<EntityCreatedEvent>();
+	const bool singleAttach = mEventSystem->hasListeners<ComponentAttachedEvent>();
+	const bool singleDetach = mEventSystem->hasListeners<ComponentDetachedEvent>();
+	const bool singleDestroyComponent = mEventSystem->hasListeners<ComponentDestroyedEvent>();
+	const bool singleDestroy = mEventSystem->hasListeners<EntityDestroyedEvent>();
+
+	if (singleCreate || singleAttach || singleDetach || singleDestroyComponent || singleDestroy)
+	{
+		// Replay the single events in the order the changes happened
+		std::size_t nextCreated = 0, nextAttached = 0, nextDetached = 0, nextDestroyedComponent = 0, nextDestroyed = 0;
+		for (auto change : order)
+		{
+			switch (change)
+			{
+			case sBatchedCreate:
+				if (singleCreate)
+					mEventSystem->emitEvent<EntityCreatedEvent>(created[nextCreated], this);
+				++nextCreated;
+				break;
+			case sBatchedAttach:
+				if (singleAttach)
+					mEventSystem->emitEvent<ComponentAttachedEvent>(attached[nextAttached], attachedTo[nextAttached], this);
+				++nextAttached;
+				break;
+			case sBatchedDetach:
+				if (singleDetach)
+					mEventSystem->emitEvent<ComponentDetachedEvent>(detached[nextDetached], detachedFrom[nextDetached], this);
+				++nextDetached;
+				break;
+			case sBatchedDestroyComponent:
+				if (singleDestroyComponent)
+					mEventSystem->emitEvent<ComponentDestroyedEvent>(destroyedComponents[nextDestroyedComponent], this);
+				++nextDestroyedComponent;
+				break;
+			case sBatchedDestroy:
+				if (singleDestroy)
+					mEventSystem->emitEvent<EntityDestroyedEvent>(destroyed[nextDestroyed], this);
+				++nextDestroyed;
+				break;
+			}
+		}
+	}
+
+	recycle(mCreatedEntities, created);
+	recycle(mAttachedComponents, attached);
+	recycle(mAttachedEntities, attachedTo);
+	recycle(mDetachedComponents, detached);
+	recycle(mDetachedEntities, detachedFrom);
+	recycle(mDestroyedComponents, destroyedComponents);
+	recycle(mDestroyedEntities, destroyed);
+	recycle(mBatchOrder, order);
+}
+
 void EntitySystem::cleanComponents()
 {
 	for (auto& family : mComponentFamilies)
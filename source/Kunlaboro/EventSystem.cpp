@@ -1,30 +1,255 @@
 #include <Kunlaboro/EventSystem.hpp>
 #include <Kunlaboro/EventSystem.inl>
 #include <Kunlaboro/EntitySystem.hpp>
+#include <Kunlaboro/detail/JobQueue.hpp>
+
+#include <thread>
 
 using namespace Kunlaboro;
 
+std::size_t BaseEventFamily::sFamilyCounter = 0;
+
 EventSystem::EventSystem(EntitySystem* es)
 	: mES(es)
+	, mJobQueue(nullptr)
 {
 }
 
 EventSystem::~EventSystem()
 {
+	drain();
+}
+
+void EventSystem::setJobQueue(detail::JobQueue* queue)
+{
+	mJobQueue = queue;
+}
+
+void EventSystem::drain()
+{
+	for (auto* async : mAsyncEvents)
+	{
+		while (async->Pending.load() != 0 || async->Jobs.load() != 0)
+		{
+			if (!async->Delivering.exchange(true, std::memory_order_acq_rel))
+				runAsync(*async);
+			else
+				std::this_thread::yield();
+		}
+	}
 }
 
 void EventSystem::unregisterAllEvents(ComponentId cId)
 {
-	for (auto& kv : mEvents)
+	auto found = mComponentEvents.find(cId);
+	if (found == mComponentEvents.end())
+		return;
+
+	// Taken out first, so the map isn't touched while removing
+	auto registered = std::move(found->second);
+	mComponentEvents.erase(found);
+
+	for (auto& ev : registered)
+		removeSlottedListener(mEvents[ev.Family], ev.ID);
+}
+
+EventSystem::ListenerList& EventSystem::getEvents(std::size_t family)
+{
+	if (family >= mEvents.size())
+		mEvents.resize(family + 1);
+
+	return mEvents[family];
+}
+
+void EventSystem::removeListener(ListenerList& list, std::size_t index)
+{
+	if (list.Emitting > 0)
 	{
-		auto it = std::find_if(kv.second.cbegin(), kv.second.cend(), [cId](const BaseEvent* ev) {
-			return ev->Type == sComponentEvent && static_cast<const detail::BaseComponentEvent*>(ev)->Component == cId;
-		});
+		list.Info[index].Type = sRemovedEvent;
+		++list.Removed;
+		return;
+	}
+
+	const auto last = list.Listeners.size() - 1;
+	if (index != last)
+	{
+		list.Listeners[index] = std::move(list.Listeners[last]);
+		list.Info[index] = list.Info[last];
+		relink(list, index, false);
+	}
+
+	list.Listeners.pop_back();
+	list.Info.pop_back();
+}
+void EventSystem::removeAdded(ListenerList& list, std::size_t index)
+{
+	const auto last = list.Added.size() - 1;
+	if (index != last)
+	{
+		list.Added[index] = std::move(list.Added[last]);
+		list.AddedInfo[index] = list.AddedInfo[last];
+		relink(list, index, true);
+	}
+
+	list.Added.pop_back();
+	list.AddedInfo.pop_back();
+}
+void EventSystem::relink(ListenerList& list, std::size_t index, bool added)
+{
+	const auto& info = (added ? list.AddedInfo[index] : list.Info[index]);
+	auto& slots = (list.Owner ? list.Owner->Slots : list.Slots);
+	if (info.Type != sRemovedEvent)
+		slots[info.ID & sSlotMask].Index = (added ? index | sAddedIndex : index);
+}
+
+EventSystem::ListenerId EventSystem::allocateSlot(ListenerList& list)
+{
+	std::uint32_t slot;
+	if (list.FreeSlots.empty())
+	{
+		slot = static_cast<std::uint32_t>(list.Slots.size());
+		list.Slots.push_back({ 0, 0, nullptr });
+	}
+	else
+	{
+		slot = list.FreeSlots.back();
+		list.FreeSlots.pop_back();
+		list.Slots[slot].Bucket = nullptr;
+	}
+
+	return (ListenerId(list.Slots[slot].Generation) << sSlotBits) | slot;
+}
+void EventSystem::removeSlottedListener(ListenerList& list, ListenerId id)
+{
+	const auto slot = static_cast<std::uint32_t>(id & sSlotMask);
+	if (slot >= list.Slots.size() || list.Slots[slot].Generation != static_cast<std::uint32_t>(id >> sSlotBits))
+		return;
 
-		if (it != kv.second.cend())
+	const auto index = list.Slots[slot].Index;
+	if (index & sAsyncIndex)
+	{
+		auto& async = *list.Async;
+		const auto position = index & ~sAsyncIndex;
+		const auto last = async.Listeners.size() - 1;
+
+		lockAsync(async);
+		if (position != last)
 		{
-			delete *it;
-			kv.second.erase(it);
+			async.Listeners[position] = std::move(async.Listeners[last]);
+			async.IDs[position] = async.IDs[last];
+			list.Slots[async.IDs[position] & sSlotMask].Index = position | sAsyncIndex;
 		}
+		async.Listeners.pop_back();
+		async.IDs.pop_back();
+		unlockAsync(async);
+	}
+	else
+	{
+		auto* bucket = list.Slots[slot].Bucket;
+		auto& target = (bucket ? *bucket : list);
+		const auto added = (index & sAddedIndex) != 0;
+		const auto info = (added ? target.AddedInfo[index & ~sAddedIndex] : target.Info[index]);
+
+		if (added)
+			removeAdded(target, index & ~sAddedIndex);
+		else
+			removeListener(target, index);
+
+		// Buckets that are being emitted stay around until a later removal
+		if (bucket && bucket->Emitting == 0 && bucket->Listeners.empty() && bucket->Added.empty())
+		{
+			if (info.Entity != EntityId::Invalid())
+				list.Scoped->Entities.erase(info.Entity);
+			else
+				list.Scoped->Components.erase(info.Component);
+		}
+	}
+
+	++list.Slots[slot].Generation;
+	list.FreeSlots.push_back(slot);
+}
+
+void EventSystem::applyDeferred(ListenerList& list)
+{
+	if (list.Removed > 0)
+	{
+		std::size_t out = 0;
+		for (std::size_t i = 0; i < list.Listeners.size(); ++i)
+		{
+			if (list.Info[i].Type == sRemovedEvent)
+				continue;
+
+			if (out != i)
+			{
+				list.Listeners[out] = std::move(list.Listeners[i]);
+				list.Info[out] = list.Info[i];
+				relink(list, out, false);
+			}
+			++out;
+		}
+
+		list.Listeners.erase(list.Listeners.begin() + out, list.Listeners.end());
+		list.Info.erase(list.Info.begin() + out, list.Info.end());
+		list.Removed = 0;
+	}
+
+	for (std::size_t i = 0; i < list.Added.size(); ++i)
+	{
+		list.Listeners.push_back(std::move(list.Added[i]));
+		list.Info.push_back(list.AddedInfo[i]);
+		relink(list, list.Listeners.size() - 1, false);
 	}
-}
\ No newline at end of file
+
+	list.Added.clear();
+	list.AddedInfo.clear();
+}
+
+void EventSystem::lockAsync(BaseAsyncEvents& async)
+{
+	while (async.Delivering.exchange(true, std::memory_order_acq_rel))
+		std::this_thread::yield();
+}
+void EventSystem::unlockAsync(BaseAsyncEvents& async) const
+{
+	async.Delivering.store(false);
+	if (async.Pending.load() != 0)
+		scheduleAsync(async);
+}
+void EventSystem::scheduleAsync(BaseAsyncEvents& async) const
+{
+	if (!mJobQueue || async.Delivering.exchange(true))
+		return;
+
+	// The job owns the delivery until it's done
+	auto* events = &async;
+	events->Jobs.fetch_add(1);
+	mJobQueue->submit([events]() {
+		runAsync(*events);
+		events->Jobs.fetch_sub(1);
+	});
+}
+void EventSystem::runAsync(BaseAsyncEvents& async)
+{
+	// Events that are queued while stopping are picked up again, unless another thread beat us to them
+	do
+	{
+		async.deliver();
+		async.Delivering.store(false);
+	} while (async.Pending.load() != 0 && !async.Delivering.exchange(true));
+}
+
+EventSystem::EmitScope::EmitScope(const ListenerList& list)
+	: List(const_cast<ListenerList&>(list))
+{
+	++List.Emitting;
+}
+EventSystem::EmitScope::~EmitScope()
+{
+	if (--List.Emitting == 0 && (List.Removed > 0 || !List.Added.empty()))
+		applyDeferred(List);
+}
+
+EventSystem::Listener::Listener()
+	: mInvoke(nullptr)
+{
+}
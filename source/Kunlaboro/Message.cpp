@@ -1,15 +1,11 @@
 #include <Kunlaboro/Message.hpp>
 #include <Kunlaboro/Message.inl>
-#include <Kunlaboro/EventSystem.inl>
 
 using namespace Kunlaboro;
 
-MessagingComponent::MessagingComponent()
+void MessagingComponent::onAttached(EntityId)
 {
-	getEntitySystem()->getEventSystem().registerEvent<EntitySystem::ComponentAttachedEvent>(getId(), [this](const EntitySystem::ComponentAttachedEvent& ev) {
-		if (ev.Component == getId())
-			addedToEntity();
-	});
+	addedToEntity();
 }
 
 void MessagingComponent::unrequestMessage(MessageId id)
@@ -1,11 +1,23 @@
 #include <Kunlaboro/MessageSystem.hpp>
 #include <Kunlaboro/MessageSystem.inl>
 #include <Kunlaboro/EntitySystem.hpp>
+#include <algorithm>
+#include <cassert>
 
 using namespace Kunlaboro;
 
+namespace
+{
+	/// Set while the thread is running the requests of a thread-safe message.
+	thread_local bool sInParallelDispatch = false;
+}
+
+std::size_t BaseChannelFamily::sFamilyCounter = 0;
+
 MessageSystem::MessageSystem(EntitySystem* es)
 	: mES(es)
+	, mIsFlushing(false)
+	, mJobQueue(nullptr)
 {
 }
 
@@ -13,37 +25,241 @@ MessageSystem::~MessageSystem()
 {
 	for (auto& msg : mMessages)
 	{
-		for (auto& cb : msg.second.Callbacks)
-			delete cb;
-
 		delete msg.second.Type;
 	}
 }
 
 void MessageSystem::unrequestAllMessages(ComponentId cId)
 {
-	for (auto& msg : mMessages)
+	auto found = mSubscriptions.find(cId);
+	if (found == mSubscriptions.end())
+		return;
+
+	auto subscriptions = std::move(found->second);
+	mSubscriptions.erase(found);
+
+	for (auto* message : subscriptions)
+		removeCallback(*message, cId);
+}
+
+void MessageSystem::unrequestAllMessages(EntityId eId)
+{
+	if (!mES->isAlive(eId))
+		return;
+
+	auto& entity = mES->entityGetList()[eId.getIndex()];
+	for (std::size_t family = 0; family < entity.Components.size(); ++family)
 	{
-		auto& cb = msg.second.Callbacks;
+		if (!entity.ComponentBits.hasBit(family))
+			continue;
 
-		auto it = std::find_if(cb.cbegin(), cb.cend(), [cId](const BaseMessageCallback* cb) { return cb->Component == cId; });
-		if (it != cb.cend())
-			cb.erase(it);
+		unrequestAllMessages(entity.Components[family]);
 	}
 }
 
-void MessageSystem::unrequestAllMessages(EntityId eId)
+void MessageSystem::setCoalescing(MessageId mId, bool coalesce)
 {
-	for (auto& msg : mMessages)
+	auto found = mMessages.find(mId);
+	if (found == mMessages.end())
+		return;
+
+	found->second.Coalesce = coalesce;
+}
+
+void MessageSystem::setThreadSafe(MessageId mId, bool threadSafe)
+{
+	auto found = mMessages.find(mId);
+	if (found == mMessages.end())
+		return;
+
+	found->second.ThreadSafe = threadSafe;
+}
+
+void MessageSystem::setJobQueue(detail::JobQueue* queue)
+{
+	mJobQueue = queue;
+}
+
+void MessageSystem::flush()
+{
+	assert(!sInParallelDispatch && "Thread-safe requests can only mail messages.");
+
+	// Flushing from inside a delivered message is a no-op
+	if (mIsFlushing)
+		return;
+
+	mIsFlushing = true;
+
+	for (auto* message : mMailboxes)
+		message->Mailbox->drain(*this, *message);
+
+	std::swap(mQueued, mFlushing);
+
+	for (auto* message : mFlushing)
+		message->Queue->flush(*this, *message);
+
+	mFlushing.clear();
+	mIsFlushing = false;
+}
+
+bool MessageSystem::inParallelDispatch()
+{
+	return sInParallelDispatch;
+}
+
+MessageSystem::DispatchScope::DispatchScope(const MessageSystem& system, const MessageData& message)
+	: System(const_cast<MessageSystem&>(system))
+	, Message(const_cast<MessageData&>(message))
+{
+	assert(!sInParallelDispatch && "Thread-safe requests can only mail messages.");
+	++Message.Dispatching;
+}
+MessageSystem::DispatchScope::~DispatchScope()
+{
+	if (--Message.Dispatching == 0 && (Message.Dirty || Message.Removed > 0 || !Message.Added.empty()))
+		System.applyDeferred(Message);
+}
+
+MessageSystem::ParallelScope::ParallelScope()
+	: Previous(sInParallelDispatch)
+{
+	sInParallelDispatch = true;
+}
+MessageSystem::ParallelScope::~ParallelScope()
+{
+	sInParallelDispatch = Previous;
+}
+
+void MessageSystem::changePriority(MessageData& message, ComponentId cId, float prio)
+{
+	assert(!sInParallelDispatch && "Thread-safe requests can only mail messages.");
+
+	auto it = message.Receivers.find(cId);
+	if (it == message.Receivers.end())
+		return;
+
+	if (message.Dispatching > 0)
 	{
-		auto& cb = msg.second.Callbacks;
+		auto* cb = findCallback(message, cId);
+		if (!cb)
+			return;
+
+		cb->Priority = prio;
+		message.Dirty = true;
+		return;
+	}
+
+	const auto index = it->second;
+	MessageCallback callback(std::move(message.Callbacks[index]));
+	callback.Priority = prio;
+	message.Callbacks.erase(message.Callbacks.begin() + index);
+
+	auto pos = std::upper_bound(message.Callbacks.begin(), message.Callbacks.end(), prio, [](float p, const MessageCallback& cb) { return p < cb.Priority; });
+	const auto newIndex = std::size_t(pos - message.Callbacks.begin());
+	message.Callbacks.insert(pos, std::move(callback));
 
-		auto it = std::remove_if(cb.begin(), cb.end(), [this, eId](const BaseMessageCallback* cb) {
-			return mES->isAttached(cb->Component, eId);
-		});
+	reindex(message, std::min(index, newIndex));
+}
+
+void MessageSystem::insertCallback(MessageData& message, MessageCallback&& callback)
+{
+	assert(!sInParallelDispatch && "Thread-safe requests can only mail messages.");
 
-		if (it != cb.end())
-			for (auto rit = it; rit != cb.end(); ++rit)
-				cb.erase(rit);
+	mSubscriptions[callback.Component].push_back(&message);
+
+	if (message.Dispatching > 0)
+	{
+		message.Receivers[callback.Component] = message.Added.size() | sAddedIndex;
+		message.Added.push_back(std::move(callback));
+		return;
 	}
+
+	// Requests with the same priority are kept in the order they were made
+	auto pos = std::upper_bound(message.Callbacks.begin(), message.Callbacks.end(), callback.Priority, [](float p, const MessageCallback& cb) { return p < cb.Priority; });
+	const auto index = std::size_t(pos - message.Callbacks.begin());
+	message.Callbacks.insert(pos, std::move(callback));
+
+	reindex(message, index);
+}
+
+void MessageSystem::removeCallback(MessageData& message, ComponentId cId)
+{
+	assert(!sInParallelDispatch && "Thread-safe requests can only mail messages.");
+
+	auto it = message.Receivers.find(cId);
+	if (it == message.Receivers.end())
+		return;
+
+	auto* cb = findCallback(message, cId);
+	message.Receivers.erase(it);
+	if (!cb)
+		return;
+
+	// Removed requests are left in place, and cleaned out in bulk
+	cb->Removed = true;
+	++message.Removed;
+
+	auto subscriptions = mSubscriptions.find(cId);
+	if (subscriptions != mSubscriptions.end())
+	{
+		auto& list = subscriptions->second;
+		auto entry = std::find(list.begin(), list.end(), &message);
+		if (entry != list.end())
+		{
+			*entry = list.back();
+			list.pop_back();
+		}
+		if (list.empty())
+			mSubscriptions.erase(subscriptions);
+	}
+
+	if (message.Dispatching == 0 && message.Removed * 2 > message.Callbacks.size())
+		applyDeferred(message);
+}
+
+void MessageSystem::applyDeferred(MessageData& message)
+{
+	if (message.Removed > 0)
+	{
+		message.Callbacks.erase(std::remove_if(message.Callbacks.begin(), message.Callbacks.end(), [](const MessageCallback& cb) { return cb.Removed; }), message.Callbacks.end());
+		message.Removed = 0;
+	}
+
+	if (message.Dirty)
+	{
+		// Requests were reprioritized during a dispatch
+		std::stable_sort(message.Callbacks.begin(), message.Callbacks.end(), [](const MessageCallback& a, const MessageCallback& b) { return a.Priority < b.Priority; });
+		message.Dirty = false;
+	}
+
+	if (!message.Added.empty())
+	{
+		for (auto& cb : message.Added)
+		{
+			if (cb.Removed)
+				continue;
+
+			auto pos = std::upper_bound(message.Callbacks.begin(), message.Callbacks.end(), cb.Priority, [](float p, const MessageCallback& cb) { return p < cb.Priority; });
+			message.Callbacks.insert(pos, std::move(cb));
+		}
+		message.Added.clear();
+	}
+
+	reindex(message, 0);
+}
+
+void MessageSystem::reindex(MessageData& message, std::size_t first)
+{
+	// Removed requests stay in place until compacted, but must not be reachable again
+	for (auto i = first; i < message.Callbacks.size(); ++i)
+		if (!message.Callbacks[i].Removed)
+			message.Receivers[message.Callbacks[i].Component] = i;
+}
+
+MessageSystem::MessageCallback::MessageCallback(ComponentId cId, float p)
+	: Component(cId)
+	, Priority(p)
+	, Removed(false)
+	, mInvoke(nullptr)
+{
 }
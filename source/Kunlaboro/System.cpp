@@ -0,0 +1,113 @@
+#include <Kunlaboro/System.hpp>
+#include <Kunlaboro/System.inl>
+#include <Kunlaboro/EntitySystem.hpp>
+
+#include <Kunlaboro/detail/JobQueue.hpp>
+
+#include <algorithm>
+
+using namespace Kunlaboro;
+
+System::System()
+	: mES(nullptr)
+{
+
+}
+
+bool System::conflictsWith(const System& other) const
+{
+	return mWrites.intersects(other.mWrites)
+		|| mWrites.intersects(other.mReads)
+		|| mReads.intersects(other.mWrites);
+}
+
+EntitySystem* System::getEntitySystem()
+{
+	return mES;
+}
+const EntitySystem* System::getEntitySystem() const
+{
+	return mES;
+}
+
+SystemScheduler::SystemScheduler(EntitySystem& es)
+	: mES(&es)
+	, mDirty(true)
+{
+
+}
+SystemScheduler::~SystemScheduler()
+{
+
+}
+
+void SystemScheduler::addSystem(System* system)
+{
+	system->mES = mES;
+	mSystems.emplace_back(system);
+	mDirty = true;
+}
+void SystemScheduler::removeSystem(const System& system)
+{
+	auto it = std::find_if(mSystems.begin(), mSystems.end(), [&system](const std::unique_ptr<System>& sys) { return sys.get() == &system; });
+	if (it == mSystems.end())
+		return;
+
+	mSystems.erase(it);
+	mDirty = true;
+}
+
+void SystemScheduler::update(float dt)
+{
+	for (auto& system : mSystems)
+		system->update(dt);
+}
+void SystemScheduler::update(float dt, detail::JobQueue& queue)
+{
+	if (mDirty)
+		buildGraph();
+
+	for (std::size_t i = 0; i < mNodes.size(); ++i)
+		mRemaining[i].store(mNodes[i].DependencyCount, std::memory_order_relaxed);
+
+	for (std::size_t i = 0; i < mNodes.size(); ++i)
+		if (mNodes[i].DependencyCount == 0)
+			queue.submit([this, i, dt, &queue]() { runSystem(i, dt, queue); });
+
+	queue.wait();
+}
+
+void SystemScheduler::buildGraph()
+{
+	const auto count = mSystems.size();
+
+	mNodes.clear();
+	mNodes.resize(count);
+	mRemaining.reset(new std::atomic<std::uint32_t>[count]);
+
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		auto& node = mNodes[i];
+		node.DependencyCount = 0;
+
+		for (std::size_t j = 0; j < i; ++j)
+		{
+			if (!mSystems[i]->conflictsWith(*mSystems[j]))
+				continue;
+
+			mNodes[j].Dependents.push_back(i);
+			++node.DependencyCount;
+		}
+	}
+
+	mDirty = false;
+}
+
+void SystemScheduler::runSystem(std::size_t index, float dt, detail::JobQueue& queue)
+{
+	mSystems[index]->update(dt);
+
+	for (auto dependent : mNodes[index].Dependents)
+		if (mRemaining[dependent].fetch_sub(1, std::memory_order_acq_rel) == 1)
+			queue.submit([this, dependent, dt, &queue]() { runSystem(dependent, dt, queue); });
+}
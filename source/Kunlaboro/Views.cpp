@@ -35,29 +35,9 @@ EntityView::Iterator EntityView::end()
 	return Iterator(mES, list.size(), mPred);
 }
 
-void EntityView::forEach(const Function& func)
+void EntityView::forEach(const FunctionRef& func)
 {
-	auto* queue = impl::BaseView<EntityView, Entity>::mQueue;
-
-	auto& list = mES->entityGetList();
-
-	for (size_t i = 0; i < list.size(); ++i)
-	{
-		auto& entData = list[i];
-		EntityId eid(i, entData.Generation);
-
-		Entity ent(const_cast<EntitySystem*>(mES), eid);
-		if (BaseView<EntityView, Entity>::mES->isAlive(eid) && (!mPred || mPred(ent)))
-		{
-			if (queue)
-				queue->submit([func, ent]() { func(ent); });
-			else
-				func(ent);
-		}
-	}
-
-	if (queue)
-		queue->wait();
+	each(func);
 }
 
 EntityView::Iterator::Iterator(const EntitySystem* sys, EntityId::IndexType index, const Predicate& pred)
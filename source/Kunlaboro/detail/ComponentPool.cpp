@@ -4,11 +4,13 @@
 using namespace Kunlaboro::detail;
 using std::size_t;
 
-BaseComponentPool::BaseComponentPool(size_t componentSize, size_t chunkSize)
+BaseComponentPool::BaseComponentPool(size_t componentSize, size_t chunkSize, size_t fieldSize)
 	: mComponentSize(componentSize)
 	, mChunkSize(chunkSize)
+	, mFieldSize(fieldSize)
 	, mSize(0)
 	, mCapacity(0)
+	, mLiveCount(0)
 {
 
 }
@@ -36,6 +38,7 @@ void BaseComponentPool::resize(size_t count, bool shrink)
 		while (mCapacity - mChunkSize >= count && !mBlocks.empty())
 		{
 			mBlocks.pop_back();
+			mBlockCounts.pop_back();
 			mCapacity -= mChunkSize;
 		}
 
@@ -45,8 +48,9 @@ void BaseComponentPool::resize(size_t count, bool shrink)
 
 	while (mCapacity < count)
 	{
-		auto* chunk = new uint8_t[mComponentSize * mChunkSize];
+		auto* chunk = new uint8_t[(mComponentSize + mFieldSize) * mChunkSize];
 		mBlocks.push_back(chunk);
+		mBlockCounts.push_back(0);
 
 		mCapacity += mChunkSize;
 	}
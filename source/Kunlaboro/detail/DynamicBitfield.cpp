@@ -37,9 +37,9 @@ void DynamicBitfield::clear()
 
 std::size_t DynamicBitfield::countBits() const
 {
-	const std::size_t bytes = static_cast<std::size_t>(std::ceil(mSize / 64.f));
+	const std::size_t words = (mSize + 63) / 64;
 	std::size_t count = 0;
-	for (std::size_t i = 0; i < bytes; ++i)
+	for (std::size_t i = 0; i < words; ++i)
 	{
 		count += popcount(static_cast<uint32_t>(mBits[i])) + popcount(static_cast<uint32_t>(mBits[i] >> 32));
 	}
@@ -47,6 +47,19 @@ std::size_t DynamicBitfield::countBits() const
 	return count;
 }
 
+bool DynamicBitfield::intersects(const DynamicBitfield& rhs) const
+{
+	const size_t smaller = std::min(mCapacity, rhs.mCapacity);
+	const uint64_t* lB = mBits.data();
+	const uint64_t* rB = rhs.mBits.data();
+
+	for (size_t i = 0; i < smaller; ++i)
+		if ((lB[i] & rB[i]) != 0)
+			return true;
+
+	return false;
+}
+
 bool DynamicBitfield::operator==(const DynamicBitfield& rhs) const
 {
 	const size_t larger = std::max(mCapacity, rhs.mCapacity);
@@ -57,7 +70,7 @@ bool DynamicBitfield::operator==(const DynamicBitfield& rhs) const
 
 	for (size_t i = 0; i < larger; ++i)
 	{
-		uint64_t res = (i > lS ? 0ull : lB[i]) ^ (i > rS ? 0ull : rB[i]);
+		uint64_t res = (i >= lS ? 0ull : lB[i]) ^ (i >= rS ? 0ull : rB[i]);
 		if (res > 0)
 			return false;
 	}
@@ -2,33 +2,60 @@
 
 using namespace Kunlaboro::detail;
 
+namespace
+{
+	/// Number of failed steal attempts before an idle worker goes to sleep.
+	const int sSpinCount = 64;
+	const std::size_t sNoWorker = ~std::size_t(0);
+}
+
+thread_local const JobQueue* JobQueue::sWorkerQueue = nullptr;
+thread_local std::size_t JobQueue::sWorkerIndex = sNoWorker;
+thread_local const JobQueue* JobQueue::sJobQueue = nullptr;
+thread_local JobQueue::Job* JobQueue::sCurrentJob = nullptr;
+
 JobQueue::JobQueue(unsigned threadCount)
-	: mExiting(false)
+	: mSleeping(0)
+	, mPending(0)
+	, mExiting(false)
 	, mCompleteWork(true)
 {
 	if (threadCount == 0)
 		threadCount = std::thread::hardware_concurrency() + 1;
 
-	mThreadPool.reserve(threadCount);
+	mWorkers.reserve(threadCount);
 	while (threadCount--)
-		mThreadPool.emplace_back(std::thread(&JobQueue::workThread, this));
+		mWorkers.emplace_back(new Worker());
+
+	startAll();
 }
 JobQueue::~JobQueue()
 {
 	abort();
+
+	for (auto* job : mFreeJobs)
+		delete job;
+	for (auto& worker : mWorkers)
+		for (auto* job : worker->FreeJobs)
+			delete job;
 }
 
 void JobQueue::abort()
 {
 	mExiting = true;
 	mCompleteWork = false;
-	mSignal.notify_all();
+	wakeAll();
 	joinAll();
 
-	{
-		std::lock_guard<std::mutex> lock(mMutex);
-		mJobQueue.clear();
-	}
+	// No threads are running at this point, so draining from the owner side is safe.
+	std::lock_guard<std::mutex> lock(mInjectMutex);
+	while (auto* job = mInjected.pop())
+		release(job);
+	for (auto& worker : mWorkers)
+		while (auto* job = worker->Jobs.pop())
+			release(job);
+
+	mPending = 0;
 }
 void JobQueue::start()
 {
@@ -39,52 +66,231 @@ void JobQueue::start()
 	mExiting = false;
 	mCompleteWork = true;
 
-	auto count = mThreadPool.size();
-	mThreadPool.clear();
-
-	mThreadPool.reserve(count);
-	while (count--)
-		mThreadPool.emplace_back(std::thread(&JobQueue::workThread, this));
+	startAll();
 }
 void JobQueue::stop()
 {
 	mExiting = true;
 	mCompleteWork = true;
-	mSignal.notify_all();
+	wakeAll();
 }
 
 void JobQueue::wait(bool restart)
 {
-	stop();
-	joinAll();
+	const auto worker = (sWorkerQueue == this ? sWorkerIndex : sNoWorker);
+	auto* parent = (sJobQueue == this ? sCurrentJob : nullptr);
+
+	// Help out with the work until everything we're waiting on is done
+	while (parent ? parent->Unfinished.load(std::memory_order_acquire) > 1 : mPending.load(std::memory_order_acquire) > 0)
+	{
+		// Aborted jobs never finish, so there's nothing left to wait for
+		if (mExiting && !mCompleteWork)
+			break;
+
+		auto* job = findJob(worker);
+		if (job)
+			execute(job);
+		else
+			std::this_thread::yield();
+	}
+
+	if (!restart && !parent)
+	{
+		stop();
+		joinAll();
+	}
+}
+
+JobQueue::Job* JobQueue::allocate()
+{
+	const auto worker = (sWorkerQueue == this ? sWorkerIndex : sNoWorker);
+
+	Job* job = nullptr;
+	if (worker != sNoWorker && !mWorkers[worker]->FreeJobs.empty())
+	{
+		job = mWorkers[worker]->FreeJobs.back();
+		mWorkers[worker]->FreeJobs.pop_back();
+	}
+	else
+	{
+		std::lock_guard<std::mutex> lock(mFreeMutex);
+		if (!mFreeJobs.empty())
+		{
+			job = mFreeJobs.back();
+			mFreeJobs.pop_back();
+		}
+	}
+
+	if (!job)
+		job = new Job();
 
-	if (restart)
-		start();
+	job->Owner = worker;
+	return job;
+}
+
+void JobQueue::release(Job* job)
+{
+	// Let go of anything the work captured right away
+	job->Work.reset();
+
+	// Records go back to where they came from, so they can't pile up on the workers that ran them
+	if (job->Owner != sNoWorker && sWorkerQueue == this && sWorkerIndex == job->Owner)
+	{
+		mWorkers[sWorkerIndex]->FreeJobs.push_back(job);
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mFreeMutex);
+	mFreeJobs.push_back(job);
+}
+
+void JobQueue::push(Job* job)
+{
+	job->Parent = (sJobQueue == this ? sCurrentJob : nullptr);
+	job->Unfinished.store(1, std::memory_order_relaxed);
+	if (job->Parent)
+		job->Parent->Unfinished.fetch_add(1, std::memory_order_relaxed);
+	mPending.fetch_add(1, std::memory_order_relaxed);
+
+	if (sWorkerQueue == this)
+		mWorkers[sWorkerIndex]->Jobs.push(job);
+	else
+	{
+		std::lock_guard<std::mutex> lock(mInjectMutex);
+		mInjected.push(job);
+	}
+
+	// Pairs with the fence in workThread, either the sleeper sees the job or we see the sleeper
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (mSleeping.load(std::memory_order_relaxed) > 0)
+	{
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+		mSignal.notify_one();
+	}
+}
+
+JobQueue::Job* JobQueue::findJob(std::size_t worker)
+{
+	const auto count = mWorkers.size();
+	if (worker < count)
+	{
+		auto* job = mWorkers[worker]->Jobs.pop();
+		if (job)
+			return job;
+	}
+
+	auto* job = mInjected.steal();
+	if (job)
+		return job;
+
+	const auto first = (worker < count ? worker + 1 : 0);
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		const auto victim = (first + i) % count;
+		if (victim == worker)
+			continue;
+
+		job = mWorkers[victim]->Jobs.steal();
+		if (job)
+			return job;
+	}
+
+	return nullptr;
+}
+
+void JobQueue::execute(Job* job)
+{
+	auto* prevQueue = sJobQueue;
+	auto* prevJob = sCurrentJob;
+	sJobQueue = this;
+	sCurrentJob = job;
+
+	job->Work();
+
+	sJobQueue = prevQueue;
+	sCurrentJob = prevJob;
+
+	finish(job);
+}
+
+void JobQueue::finish(Job* job)
+{
+	// A job is only done once all of the jobs it submitted are done as well
+	while (job && job->Unfinished.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		auto* parent = job->Parent;
+		release(job);
+
+		if (mPending.fetch_sub(1, std::memory_order_acq_rel) == 1 && mExiting)
+			wakeAll();
+
+		job = parent;
+	}
+}
+
+void JobQueue::wakeAll()
+{
+	std::lock_guard<std::mutex> lock(mSleepMutex);
+	mSignal.notify_all();
+}
+
+void JobQueue::startAll()
+{
+	for (std::size_t i = 0; i < mWorkers.size(); ++i)
+		mWorkers[i]->Thread = std::thread(&JobQueue::workThread, this, i);
 }
 
 void JobQueue::joinAll()
 {
-	for (auto& t : mThreadPool)
-		if (t.joinable())
-			t.join();
+	for (auto& worker : mWorkers)
+		if (worker->Thread.joinable())
+			worker->Thread.join();
 }
 
-void JobQueue::workThread()
+void JobQueue::workThread(std::size_t index)
 {
-	std::unique_lock<std::mutex> lock(mMutex);
-	while (!mExiting || (mCompleteWork && !mJobQueue.empty()))
+	sWorkerQueue = this;
+	sWorkerIndex = index;
+
+	int spins = 0;
+	while (true)
 	{
-		if (mJobQueue.empty())
-			mSignal.wait(lock);
-		else
+		// An abort leaves the remaining jobs for abort() to discard
+		if (mExiting && !mCompleteWork)
+			break;
+
+		auto* job = findJob(index);
+		if (job)
 		{
-			std::function<void()> work(std::move(mJobQueue.front()));
-			mJobQueue.pop_front();
-			lock.unlock();
+			execute(job);
+			spins = 0;
+			continue;
+		}
 
-			work();
+		if (mExiting && (!mCompleteWork || mPending == 0))
+			break;
 
-			lock.lock();
+		if (++spins < sSpinCount)
+		{
+			std::this_thread::yield();
+			continue;
 		}
+		spins = 0;
+
+		std::unique_lock<std::mutex> lock(mSleepMutex);
+		mSleeping.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		bool hasWork = !mInjected.empty();
+		for (auto& worker : mWorkers)
+			hasWork = hasWork || !worker->Jobs.empty();
+
+		if (!hasWork && !(mExiting && (!mCompleteWork || mPending == 0)))
+			mSignal.wait(lock);
+
+		mSleeping.fetch_sub(1, std::memory_order_relaxed);
 	}
+
+	sWorkerQueue = nullptr;
+	sWorkerIndex = sNoWorker;
 }
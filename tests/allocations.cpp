@@ -0,0 +1,168 @@
+#include <Kunlaboro/Component.hpp>
+#include <Kunlaboro/EntitySystem.inl>
+#include <Kunlaboro/MessageSystem.inl>
+#include <Kunlaboro/detail/JobQueue.hpp>
+#include "catch.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Counts heap allocations, to make sure hot paths don't allocate.
+// This replaces the allocation functions of the whole binary, which is why
+// these checks are built as their own test executable.
+
+namespace
+{
+	std::atomic<uint64_t> allocations(0);
+
+	void* countedAlloc(std::size_t size) noexcept
+	{
+		allocations.fetch_add(1, std::memory_order_relaxed);
+		return std::malloc(size > 0 ? size : 1);
+	}
+}
+
+void* operator new(std::size_t size)
+{
+	if (auto* ptr = countedAlloc(size))
+		return ptr;
+	throw std::bad_alloc();
+}
+void* operator new[](std::size_t size)
+{
+	if (auto* ptr = countedAlloc(size))
+		return ptr;
+	throw std::bad_alloc();
+}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	return countedAlloc(size);
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	return countedAlloc(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
+void operator delete[](void* ptr) noexcept
+{
+	std::free(ptr);
+}
+void operator delete(void* ptr, std::size_t) noexcept
+{
+	std::free(ptr);
+}
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+	std::free(ptr);
+}
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+	std::free(ptr);
+}
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+	std::free(ptr);
+}
+
+struct BenchmarkChannel : public Kunlaboro::Channel<int> { };
+
+TEST_CASE("message dispatch - 1 000 receivers", "[.performance][message]")
+{
+	Kunlaboro::EntitySystem es;
+	auto& ms = es.getMessageSystem();
+
+	ms.registerMessage<int>("Benchmark.Value");
+	const auto mId = Kunlaboro::MessageSystem::hash("Benchmark.Value");
+
+	uint64_t sum = 0;
+	for (uint32_t i = 0; i < 1000; ++i)
+	{
+		ms.requestMessage<int>(Kunlaboro::ComponentId(i, 0, 0), mId, [&sum](int value) { sum += value; }, float(i % 10));
+		ms.request<BenchmarkChannel>(Kunlaboro::ComponentId(i, 0, 0), [&sum](int value) { sum += value; }, float(i % 10));
+	}
+
+	SECTION("global dispatch - 50 000 sends")
+	{
+		const auto before = allocations.load();
+		for (int i = 0; i < 50000; ++i)
+			ms.sendMessage<int>(mId, 1);
+		const auto after = allocations.load();
+
+		CHECK(sum == 50000000);
+		REQUIRE(after == before);
+	}
+	SECTION("channel dispatch - 50 000 sends")
+	{
+		const auto before = allocations.load();
+		for (int i = 0; i < 50000; ++i)
+			ms.send<BenchmarkChannel>(1);
+		const auto after = allocations.load();
+
+		CHECK(sum == 50000000);
+		REQUIRE(after == before);
+	}
+	SECTION("queued dispatch - 50 frames of 1 000 posts")
+	{
+		// Warm up the queue buffers, they're reused after the first frames
+		for (int frame = 0; frame < 2; ++frame)
+		{
+			for (int i = 0; i < 1000; ++i)
+				ms.post<BenchmarkChannel>(0);
+			ms.flush();
+		}
+
+		const auto before = allocations.load();
+		for (int frame = 0; frame < 50; ++frame)
+		{
+			for (int i = 0; i < 1000; ++i)
+				ms.post<BenchmarkChannel>(1);
+			ms.flush();
+		}
+		const auto after = allocations.load();
+
+		CHECK(sum == 50000000);
+		REQUIRE(after == before);
+	}
+	SECTION("local dispatch - 50 000 sends")
+	{
+		const auto before = allocations.load();
+		for (uint32_t i = 0; i < 50000; ++i)
+			ms.sendMessageTo<int>(mId, Kunlaboro::ComponentId(i % 1000, 0, 0), 1);
+		const auto after = allocations.load();
+
+		CHECK(sum == 50000);
+		REQUIRE(after == before);
+	}
+}
+
+struct ParallelBenchmarkChannel : public Kunlaboro::Channel<int> { };
+
+TEST_CASE("parallel message dispatch - 4 000 receivers", "[.performance][message]")
+{
+	Kunlaboro::detail::JobQueue queue(4);
+	Kunlaboro::EntitySystem es;
+	auto& ms = es.getMessageSystem();
+	ms.setJobQueue(&queue);
+	ms.setThreadSafe<ParallelBenchmarkChannel>(true);
+
+	std::atomic<uint64_t> sum(0);
+	for (uint32_t i = 0; i < 4000; ++i)
+		ms.request<ParallelBenchmarkChannel>(Kunlaboro::ComponentId(i, 0, 0), [&sum](int value) { sum.fetch_add(value, std::memory_order_relaxed); });
+
+	// Warm up the job records, they're recycled once enough have been made
+	for (int i = 0; i < 200; ++i)
+		ms.send<ParallelBenchmarkChannel>(0);
+
+	const auto before = allocations.load();
+	for (int i = 0; i < 1000; ++i)
+		ms.send<ParallelBenchmarkChannel>(1);
+	const auto after = allocations.load();
+
+	CHECK(sum == 4000000);
+	REQUIRE(after == before);
+}
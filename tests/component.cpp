@@ -4,6 +4,10 @@
 
 #include "catch.hpp"
 
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
 class TestComponent : public Kunlaboro::Component
 {
 public:
@@ -184,4 +188,168 @@ TEST_CASE("Component views", "[component][view]")
 
 		REQUIRE(combinedValue == 10);
 	}
+
+	SECTION("View iteration with a function reference")
+	{
+		int combinedValue = 0;
+		auto sum = [&combinedValue](TestComponent& comp) { combinedValue += comp.getData(); };
+		const Kunlaboro::ComponentView<TestComponent>::FunctionRef func(sum);
+		collection.forEach(func);
+
+		REQUIRE(combinedValue == 45);
+	}
+
+	SECTION("View iteration with a stored function")
+	{
+		int combinedValue = 0;
+		Kunlaboro::ComponentView<TestComponent>::Function func;
+		{
+			auto sum = [&combinedValue](TestComponent& comp) { combinedValue += comp.getData(); };
+			func = sum;
+		}
+		collection.forEach(func);
+
+		REQUIRE(combinedValue == 45);
+	}
+
+	SECTION("View iteration with forEachChunk")
+	{
+		es.destroyComponent(components[3]->getId());
+		es.destroyComponent(components[7]->getId());
+
+		int combinedValue = 0, visited = 0;
+		collection.forEachChunk([&combinedValue, &visited](TestComponent* comps, std::size_t count, const std::uint64_t* mask) {
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				if (mask && (mask[i / 64] & (1ull << (i % 64))) == 0)
+					continue;
+
+				combinedValue += comps[i].getData();
+				++visited;
+			}
+		});
+
+		REQUIRE(visited == 8);
+		REQUIRE(combinedValue == 35);
+	}
+}
+
+TEST_CASE("Dynamic bitfield", "[component]")
+{
+	Kunlaboro::detail::DynamicBitfield bits;
+
+	bits.setBit(3);
+	bits.setBit(200);
+	bits.setBit(1000000);
+	CHECK(bits.getSize() == 1000001);
+	CHECK(bits.countBits() == 3);
+
+	bits.clearBit(1000001);
+	CHECK(bits.getSize() == 1000001);
+
+	// Clearing leaves the size as a high-water mark
+	bits.clearBit(1000000);
+	CHECK(bits.getSize() == 1000001);
+	CHECK(!bits.hasBit(1000000));
+	CHECK(bits.hasBit(200));
+
+	bits.shrink();
+	CHECK(bits.getSize() == 201);
+
+	bits.clearBit(3);
+	CHECK(!bits.hasBit(3));
+	CHECK(bits.countBits() == 1);
+
+	bits.clearBit(200);
+	bits.shrink();
+	CHECK(bits.getSize() == 0);
+	CHECK(bits.countBits() == 0);
+
+	bits.setBit(63);
+	Kunlaboro::detail::DynamicBitfield other;
+	other.setBit(63);
+	REQUIRE(bits == other);
+}
+
+TEST_CASE("Sparse component views", "[component][view]")
+{
+	Kunlaboro::EntitySystem es;
+	const auto family = Kunlaboro::ComponentFamily<TestComponent>::getFamily();
+
+	for (int i = 0; i < 5000; ++i)
+		es.createComponent<TestComponent>(i).unlink();
+
+	const int kept[] = { 3, 64, 1000, 4095, 4999 };
+	for (int i = 0; i < 5000; ++i)
+		if (std::find(std::begin(kept), std::end(kept), i) == std::end(kept))
+			es.destroyComponent(Kunlaboro::ComponentId(i, 0, family));
+
+	auto& pool = es.componentGetPool(family);
+	CHECK(pool.countBits() == 5);
+	CHECK(pool.findNext(0) == 3);
+	CHECK(pool.findNext(65) == 1000);
+	CHECK(pool.findNext(4096) == 4999);
+	CHECK(pool.findNext(5000) == pool.getSize());
+
+	std::vector<int> visited;
+	Kunlaboro::ComponentView<TestComponent>(es).forEach([&visited](TestComponent& comp) { visited.push_back(comp.getData()); });
+
+	REQUIRE(visited == std::vector<int>(std::begin(kept), std::end(kept)));
+}
+
+struct SoAPosition : public Kunlaboro::SoAComponent<SoAPosition, float, float, int>
+{
+	enum { X, Y, Tag };
+
+	SoAPosition(float x, float y)
+	{
+		field<X>() = x;
+		field<Y>() = y;
+	}
+};
+
+TEST_CASE("Structure of array components", "[component][view]")
+{
+	Kunlaboro::EntitySystem es;
+
+	std::vector<Kunlaboro::ComponentHandle<SoAPosition>> components;
+	for (int i = 0; i < 300; ++i)
+		components.push_back(es.createComponent<SoAPosition>(float(i), float(-i)));
+
+	SECTION("Field access")
+	{
+		REQUIRE(components[10]->field<SoAPosition::X>() == 10.f);
+		REQUIRE(components[10]->field<SoAPosition::Y>() == -10.f);
+		REQUIRE(components[10]->field<SoAPosition::Tag>() == 0);
+		REQUIRE(components[299]->field<SoAPosition::X>() == 299.f);
+
+		components[10]->field<SoAPosition::Tag>() = 5;
+		REQUIRE(components[10]->field<SoAPosition::Tag>() == 5);
+		REQUIRE(components[11]->field<SoAPosition::Tag>() == 0);
+	}
+
+	SECTION("Field iteration")
+	{
+		es.destroyComponent(components[299]->getId());
+
+		auto view = Kunlaboro::ComponentView<SoAPosition>(es);
+		view.forEachFields([](std::size_t count, const std::uint64_t* mask, float* x, float* y, int* tag) {
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				if (mask && (mask[i / 64] & (1ull << (i % 64))) == 0)
+					continue;
+
+				x[i] += y[i];
+				tag[i] = 1;
+			}
+		});
+
+		REQUIRE(components[10]->field<SoAPosition::X>() == 0.f);
+		REQUIRE(components[298]->field<SoAPosition::X>() == 0.f);
+		REQUIRE(components[298]->field<SoAPosition::Tag>() == 1);
+
+		int tagged = 0;
+		view.forEach([&tagged](SoAPosition& pos) { tagged += pos.field<SoAPosition::Tag>(); });
+		REQUIRE(tagged == 299);
+	}
 }
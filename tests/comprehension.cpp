@@ -7,6 +7,7 @@
 
 #include <atomic>
 #include <random>
+#include <vector>
 
 struct NumberComponent : public Kunlaboro::Component
 {
@@ -102,6 +103,35 @@ TEST_CASE("fizzbuzz", "[comprehensive][view]")
 
 		REQUIRE(result == "1 fizz 3 buzz 5 7 fizz 9 11 13 fizzbuzz 15 ");
 	}
+
+	SECTION("forEach - match all, entity only")
+	{
+		std::string result;
+
+		view.withComponents<Kunlaboro::Match_All, NumberComponent, NameComponent>()
+		    .forEach([&result](Kunlaboro::Entity& ent) {
+			result += ent.getComponent<NameComponent>()->Name + " ";
+		});
+
+		REQUIRE(result == "fizz buzz fizz fizz buzz fizz fizzbuzz ");
+	}
+
+	SECTION("forEach - destroyed entities")
+	{
+		std::vector<Kunlaboro::EntityId> entities;
+		view.forEach([&entities](const Kunlaboro::Entity& ent) { entities.push_back(ent.getId()); });
+		REQUIRE(entities.size() == 15);
+
+		es.destroyEntity(entities[2]);
+		es.destroyEntity(entities[9]);
+
+		std::string result;
+		view.forEach([&result](const Kunlaboro::Entity& ent) {
+			result += std::to_string(ent.getComponent<NumberComponent>()->Number) + " ";
+		});
+
+		REQUIRE(result == "1 2 4 5 6 7 8 9 11 12 13 14 15 ");
+	}
 }
 
 struct Position : public Kunlaboro::Component
@@ -272,3 +302,73 @@ TEST_CASE("Simple n-body simulation - 1000 particles", "[comprehensive][performa
 	}
 	*/
 }
+
+TEST_CASE("View reduction", "[comprehensive][view]")
+{
+	Kunlaboro::EntitySystem es;
+
+	for (int i = 1; i <= 5000; ++i)
+	{
+		auto ent = es.createEntity();
+		ent.addComponent<NumberComponent>(i);
+
+		if (i % 3 == 0)
+			ent.addComponent<NameComponent>("fizz");
+	}
+
+	Kunlaboro::detail::JobQueue queue(4);
+	auto sum = [](int64_t a, int64_t b) { return a + b; };
+
+	SECTION("Component reduction")
+	{
+		auto view = Kunlaboro::ComponentView<NumberComponent>(es);
+
+		auto accumulate = [](int64_t acc, NumberComponent& num) { return acc + num.Number; };
+
+		REQUIRE(view.reduce(int64_t(0), accumulate, sum) == 12502500);
+		REQUIRE(view.parallel(queue).reduce(int64_t(0), accumulate, sum) == 12502500);
+		REQUIRE(view.parallel(queue).reduce(int64_t(0), accumulate, sum, Kunlaboro::Reduce_Ordered) == 12502500);
+
+		auto odd = view.where([](const NumberComponent& num) { return num.Number % 2 == 1; })
+		               .parallel(queue)
+		               .transformReduce(int64_t(0), sum, [](NumberComponent&) { return int64_t(1); });
+		REQUIRE(odd == 2500);
+	}
+
+	SECTION("Parallel component forEach")
+	{
+		auto view = Kunlaboro::ComponentView<NumberComponent>(es);
+
+		view.parallel(queue).forEach([](NumberComponent& num) { num.Number *= 2; });
+
+		REQUIRE(view.reduce(int64_t(0), [](int64_t acc, NumberComponent& num) { return acc + num.Number; }, sum) == 25005000);
+	}
+
+	SECTION("Entity reduction")
+	{
+		auto view = Kunlaboro::EntityView(es).withComponents<Kunlaboro::Match_All, NumberComponent, NameComponent>();
+
+		auto count = view.parallel(queue).transformReduce(int64_t(0), sum, [](const Kunlaboro::Entity&, NumberComponent&, NameComponent&) {
+			return int64_t(1);
+		});
+		REQUIRE(count == 1666);
+
+		auto largest = view.parallel(queue).reduce(0, [](int acc, const Kunlaboro::Entity&, NumberComponent& num, NameComponent&) {
+			return std::max(acc, num.Number);
+		}, [](int a, int b) { return std::max(a, b); });
+		REQUIRE(largest == 4998);
+	}
+
+	SECTION("Ordered float reduction is reproducible")
+	{
+		auto view = Kunlaboro::ComponentView<NumberComponent>(es);
+		auto fsum = [](float a, float b) { return a + b; };
+		auto inverse = [](NumberComponent& num) { return 1.f / num.Number; };
+
+		const float sequential = view.transformReduce(0.f, fsum, inverse, Kunlaboro::Reduce_Ordered);
+
+		Kunlaboro::detail::JobQueue otherQueue(3);
+		REQUIRE(view.parallel(queue).transformReduce(0.f, fsum, inverse, Kunlaboro::Reduce_Ordered) == sequential);
+		REQUIRE(view.parallel(otherQueue).transformReduce(0.f, fsum, inverse, Kunlaboro::Reduce_Ordered) == sequential);
+	}
+}
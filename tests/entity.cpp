@@ -7,6 +7,9 @@
 #include <Kunlaboro/Views.inl>
 #include "catch.hpp"
 
+#include <string>
+#include <vector>
+
 class EntityMessagingTestComponent : public Kunlaboro::MessagingComponent
 {
 public:
@@ -34,6 +37,23 @@ private:
 	int mData;
 };
 
+class LifecycleTestComponent : public Kunlaboro::Component
+{
+public:
+	LifecycleTestComponent()
+		: Attached(Kunlaboro::EntityId::Invalid())
+		, Detached(Kunlaboro::EntityId::Invalid())
+	{
+
+	}
+
+	Kunlaboro::EntityId Attached, Detached;
+
+protected:
+	void onAttached(Kunlaboro::EntityId eid) override { Attached = eid; }
+	void onDetached(Kunlaboro::EntityId eid) override { Detached = eid; }
+};
+
 TEST_CASE("entity creation", "[entity]")
 {
 	Kunlaboro::EntitySystem es;
@@ -68,3 +88,136 @@ TEST_CASE("Message passing", "[entity][message]")
 	auto comp = ent.getComponent<EntityMessagingTestComponent>();
 	REQUIRE(comp->getData() == 5);
 }
+
+TEST_CASE("Component lifecycle hooks", "[entity]")
+{
+	Kunlaboro::EntitySystem es;
+
+	auto first = es.createEntity();
+	auto second = es.createEntity();
+	auto comp = es.createComponent<LifecycleTestComponent>();
+
+	CHECK(comp->getEntityId() == Kunlaboro::EntityId::Invalid());
+
+	es.attachComponent(comp->getId(), first.getId());
+	CHECK(comp->Attached == first.getId());
+	CHECK(comp->getEntityId() == first.getId());
+
+	es.attachComponent(comp->getId(), second.getId());
+	CHECK(comp->Detached == first.getId());
+	CHECK(comp->Attached == second.getId());
+	CHECK(comp->getEntityId() == second.getId());
+	CHECK_FALSE(first.hasComponent<LifecycleTestComponent>());
+
+	es.detachComponent(comp->getId(), second.getId());
+	CHECK(comp->Detached == second.getId());
+	CHECK(comp->getEntityId() == Kunlaboro::EntityId::Invalid());
+}
+
+TEST_CASE("Batched lifecycle events", "[entity]")
+{
+	Kunlaboro::EntitySystem es;
+	auto& evs = es.getEventSystem();
+
+	std::size_t batches = 0, batched = 0, single = 0;
+	evs.registerEvent<Kunlaboro::EntitySystem::EntitiesDestroyedEvent>([&](const Kunlaboro::EntitySystem::EntitiesDestroyedEvent& ev) {
+		++batches;
+		batched += ev.Count;
+	});
+	evs.registerEvent<Kunlaboro::EntitySystem::EntityDestroyedEvent>([&](const Kunlaboro::EntitySystem::EntityDestroyedEvent&) {
+		++single;
+	});
+
+	std::vector<Kunlaboro::EntityId> entities;
+	for (int i = 0; i < 10; ++i)
+		entities.push_back(es.createEntity().getId());
+
+	es.destroyEntity(entities.back());
+	entities.pop_back();
+
+	CHECK(batches == 1);
+	CHECK(batched == 1);
+	CHECK(single == 1);
+
+	es.beginBatch();
+	es.beginBatch();
+	for (auto eid : entities)
+		es.destroyEntity(eid);
+	es.endBatch();
+
+	CHECK(es.isBatching());
+	CHECK(batches == 1);
+	CHECK(single == 1);
+
+	es.endBatch();
+
+	CHECK_FALSE(es.isBatching());
+	CHECK(batches == 2);
+	CHECK(batched == 10);
+	REQUIRE(single == 10);
+}
+
+TEST_CASE("Batched lifecycle event order", "[entity]")
+{
+	Kunlaboro::EntitySystem es;
+	auto& evs = es.getEventSystem();
+
+	std::string changes;
+	evs.registerEvent<Kunlaboro::EntitySystem::EntityCreatedEvent>([&changes](const Kunlaboro::EntitySystem::EntityCreatedEvent&) {
+		changes += "c";
+	});
+	evs.registerEvent<Kunlaboro::EntitySystem::EntityDestroyedEvent>([&changes](const Kunlaboro::EntitySystem::EntityDestroyedEvent&) {
+		changes += "d";
+	});
+
+	es.beginBatch();
+	auto first = es.createEntity();
+	es.destroyEntity(first.getId());
+	es.createEntity();
+	es.endBatch();
+
+	REQUIRE(changes == "cdc");
+}
+
+TEST_CASE("Batched component detaching", "[entity]")
+{
+	Kunlaboro::EntitySystem es;
+	auto& evs = es.getEventSystem();
+
+	std::string changes;
+	std::vector<Kunlaboro::EntityId> detachedFrom;
+	evs.registerEvent<Kunlaboro::EntitySystem::ComponentAttachedEvent>([&changes](const Kunlaboro::EntitySystem::ComponentAttachedEvent&) {
+		changes += "a";
+	});
+	evs.registerEvent<Kunlaboro::EntitySystem::ComponentDetachedEvent>([&changes](const Kunlaboro::EntitySystem::ComponentDetachedEvent&) {
+		changes += "d";
+	});
+	evs.registerEvent<Kunlaboro::EntitySystem::ComponentsDetachedEvent>([&detachedFrom](const Kunlaboro::EntitySystem::ComponentsDetachedEvent& ev) {
+		detachedFrom.insert(detachedFrom.end(), ev.Entities, ev.Entities + ev.Count);
+	});
+
+	auto first = es.createEntity();
+	auto second = es.createEntity();
+	auto comp = es.createComponent<LifecycleTestComponent>();
+
+	es.beginBatch();
+	es.attachComponent(comp->getId(), first.getId());
+	es.attachComponent(comp->getId(), second.getId());
+	es.detachComponent(comp->getId(), second.getId());
+
+	CHECK(changes.empty());
+	CHECK(detachedFrom.empty());
+
+	es.endBatch();
+
+	CHECK(changes == "adad");
+	REQUIRE(detachedFrom.size() == 2);
+	CHECK(detachedFrom[0] == first.getId());
+	CHECK(detachedFrom[1] == second.getId());
+
+	es.attachComponent(comp->getId(), first.getId());
+	es.detachComponent(comp->getId(), first.getId());
+
+	CHECK(changes == "adadad");
+	REQUIRE(detachedFrom.size() == 3);
+}
@@ -0,0 +1,288 @@
+#include <Kunlaboro/Component.hpp>
+#include <Kunlaboro/Entity.inl>
+#include <Kunlaboro/EntitySystem.inl>
+#include <Kunlaboro/EventSystem.inl>
+#include "catch.hpp"
+
+#include <string>
+#include <vector>
+
+namespace
+{
+	struct ValueEvent
+	{
+		int Value;
+	};
+	struct OtherEvent
+	{
+		int Value;
+	};
+	struct UnusedEvent
+	{
+		int Value;
+	};
+	struct ScopedComponent : public Kunlaboro::Component
+	{
+	};
+	struct KeyedEvent
+	{
+		Kunlaboro::ComponentId Component;
+		Kunlaboro::EntityId Entity;
+	};
+	struct EntityKeyedEvent
+	{
+		Kunlaboro::EntityId Entity;
+	};
+	struct ComponentKeyedEvent
+	{
+		Kunlaboro::ComponentId Component;
+	};
+}
+
+TEST_CASE("Event emission", "[event]")
+{
+	Kunlaboro::EntitySystem es;
+	auto& evs = es.getEventSystem();
+
+	int loose = 0, component = 0, other = 0;
+	const auto listener = evs.registerEvent<ValueEvent>([&loose](const ValueEvent& ev) { loose += ev.Value; });
+	evs.registerEvent<ValueEvent>(Kunlaboro::ComponentId(0, 0, 0), [&component](const ValueEvent& ev) { component += ev.Value; });
+	evs.registerEvent<OtherEvent>(Kunlaboro::ComponentId(0, 0, 0), [&other](const OtherEvent& ev) { other += ev.Value; });
+
+	evs.emitEvent<ValueEvent>(2);
+	evs.emitEvent<OtherEvent>(3);
+	evs.emitEvent<UnusedEvent>(4);
+
+	CHECK(loose == 2);
+	CHECK(component == 2);
+	CHECK(other == 3);
+
+	evs.unregisterEvent<ValueEvent>(listener);
+	evs.unregisterEvent<ValueEvent>(Kunlaboro::ComponentId(0, 0, 0));
+	evs.emitEvent<ValueEvent>(2);
+	evs.emitEvent<OtherEvent>(3);
+
+	CHECK(loose == 2);
+	CHECK(component == 2);
+	CHECK(other == 6);
+
+	evs.unregisterAllEvents(Kunlaboro::ComponentId(0, 0, 0));
+	evs.emitEvent<OtherEvent>(3);
+
+	REQUIRE(other == 6);
+}
+
+TEST_CASE("Event listener changes during emit", "[event]")
+{
+	Kunlaboro::EntitySystem es;
+	auto& evs = es.getEventSystem();
+
+	// Large enough to not fit in the inline storage
+	const std::string padding(64, 'x');
+
+	int first = 0, second = 0, added = 0;
+	evs.registerEvent<ValueEvent>(Kunlaboro::ComponentId(0, 0, 0), [&](const ValueEvent& ev) {
+		first += ev.Value;
+
+		evs.unregisterEvent<ValueEvent>(Kunlaboro::ComponentId(0, 0, 0));
+		evs.unregisterEvent<ValueEvent>(Kunlaboro::ComponentId(1, 0, 0));
+		evs.registerEvent<ValueEvent>([&added](const ValueEvent& ev) { added += ev.Value; });
+		evs.emitEvent<ValueEvent>(10);
+	});
+	evs.registerEvent<ValueEvent>(Kunlaboro::ComponentId(1, 0, 0), [&second, padding](const ValueEvent& ev) {
+		second += ev.Value + int(padding.size());
+	});
+
+	evs.emitEvent<ValueEvent>(1);
+
+	CHECK(first == 1);
+	CHECK(second == 0);
+	CHECK(added == 0);
+
+	evs.emitEvent<ValueEvent>(2);
+
+	CHECK(first == 1);
+	CHECK(second == 0);
+	REQUIRE(added == 2);
+}
+
+TEST_CASE("Loose event listener handles", "[event]")
+{
+	Kunlaboro::EntitySystem es;
+	auto& evs = es.getEventSystem();
+
+	int calls[3] = { 0, 0, 0 };
+	auto first = evs.registerEvent<ValueEvent>([&calls](const ValueEvent&) { ++calls[0]; });
+	auto second = evs.registerEvent<ValueEvent>([&calls](const ValueEvent&) { ++calls[1]; });
+
+	evs.unregisterEvent<ValueEvent>(first);
+
+	// Reuses the slot of the first listener, but not its ID
+	auto third = evs.registerEvent<ValueEvent>([&calls](const ValueEvent&) { ++calls[2]; });
+	CHECK(third != first);
+	CHECK(third != second);
+
+	evs.unregisterEvent<ValueEvent>(first);
+	evs.emitEvent<ValueEvent>(0);
+
+	CHECK(calls[0] == 0);
+	CHECK(calls[1] == 1);
+	CHECK(calls[2] == 1);
+
+	evs.unregisterEvent<ValueEvent>(second);
+	evs.emitEvent<ValueEvent>(0);
+
+	CHECK(calls[1] == 1);
+	CHECK(calls[2] == 2);
+
+	SECTION("Churn")
+	{
+		std::vector<Kunlaboro::EventSystem::ListenerId> ids;
+		int churn = 0;
+		for (int round = 0; round < 4; ++round)
+		{
+			for (int i = 0; i < 1000; ++i)
+				ids.push_back(evs.registerEvent<OtherEvent>([&churn](const OtherEvent&) { ++churn; }));
+			for (std::size_t i = 0; i < ids.size(); i += 2)
+				evs.unregisterEvent<OtherEvent>(ids[i]);
+
+			std::vector<Kunlaboro::EventSystem::ListenerId> kept;
+			for (std::size_t i = 1; i < ids.size(); i += 2)
+				kept.push_back(ids[i]);
+			ids.swap(kept);
+		}
+
+		evs.emitEvent<OtherEvent>(0);
+		CHECK(churn == int(ids.size()));
+
+		for (auto id : ids)
+			evs.unregisterEvent<OtherEvent>(id);
+
+		churn = 0;
+		evs.emitEvent<OtherEvent>(0);
+		REQUIRE(churn == 0);
+	}
+
+	SECTION("Mixed with component listeners")
+	{
+		int loose = 0, component = 0;
+		const auto id = evs.registerEvent<OtherEvent>([&loose](const OtherEvent&) { ++loose; });
+		for (uint32_t i = 0; i < 100; ++i)
+			evs.registerEvent<OtherEvent>(Kunlaboro::ComponentId(i, 0, 0), [&component](const OtherEvent&) { ++component; });
+
+		// Removing component listeners moves the others around, the loose handle must follow
+		for (uint32_t i = 0; i < 100; i += 2)
+			evs.unregisterAllEvents(Kunlaboro::ComponentId(i, 0, 0));
+		evs.emitEvent<OtherEvent>(0);
+
+		CHECK(loose == 1);
+		CHECK(component == 50);
+
+		evs.unregisterEvent<OtherEvent>(id);
+		for (uint32_t i = 1; i < 100; i += 2)
+			evs.unregisterEvent<OtherEvent>(Kunlaboro::ComponentId(i, 0, 0));
+		evs.emitEvent<OtherEvent>(0);
+
+		CHECK(loose == 1);
+		REQUIRE(component == 50);
+	}
+}
+
+TEST_CASE("Scoped event listeners", "[event]")
+{
+	Kunlaboro::EntitySystem es;
+	auto& evs = es.getEventSystem();
+
+	const Kunlaboro::EntityId entA(1, 0), entB(2, 0);
+	const Kunlaboro::ComponentId compA(1, 0, 0), compB(2, 0, 0);
+
+	int entityCalls = 0, componentCalls = 0, looseCalls = 0;
+	auto entityListener = evs.registerScopedEvent<KeyedEvent>(entA, [&entityCalls](const KeyedEvent&) { ++entityCalls; });
+	auto componentListener = evs.registerScopedEvent<KeyedEvent>(compB, [&componentCalls](const KeyedEvent&) { ++componentCalls; });
+	evs.registerEvent<KeyedEvent>([&looseCalls](const KeyedEvent&) { ++looseCalls; });
+
+	CHECK(evs.hasListeners<KeyedEvent>());
+
+	evs.emitEvent(KeyedEvent{ compA, entA });
+	evs.emitEvent(KeyedEvent{ compB, entB });
+	evs.emitEvent(KeyedEvent{ compA, entB });
+
+	CHECK(entityCalls == 1);
+	CHECK(componentCalls == 1);
+	CHECK(looseCalls == 3);
+
+	evs.unregisterEvent<KeyedEvent>(entityListener);
+	evs.unregisterEvent<KeyedEvent>(entityListener);
+	evs.emitEvent(KeyedEvent{ compB, entA });
+
+	CHECK(entityCalls == 1);
+	CHECK(componentCalls == 2);
+
+	SECTION("Changes during emit")
+	{
+		Kunlaboro::EventSystem::ListenerId added = 0;
+		int addedCalls = 0;
+		evs.registerScopedEvent<KeyedEvent>(compA, [&](const KeyedEvent&) {
+			evs.unregisterEvent<KeyedEvent>(componentListener);
+			if (added == 0)
+				added = evs.registerScopedEvent<KeyedEvent>(compA, [&addedCalls](const KeyedEvent&) { ++addedCalls; });
+		});
+
+		evs.emitEvent(KeyedEvent{ compA, entA });
+		CHECK(addedCalls == 0);
+
+		evs.emitEvent(KeyedEvent{ compA, entA });
+		evs.emitEvent(KeyedEvent{ compB, entA });
+		CHECK(addedCalls == 1);
+		CHECK(componentCalls == 2);
+	}
+
+	SECTION("Lifecycle events")
+	{
+		auto ent = es.createEntity();
+		auto other = es.createEntity();
+		int attached = 0;
+		evs.registerScopedEvent<Kunlaboro::EntitySystem::ComponentAttachedEvent>(ent.getId(), [&attached](const Kunlaboro::EntitySystem::ComponentAttachedEvent&) { ++attached; });
+
+		other.addComponent<ScopedComponent>();
+		CHECK(attached == 0);
+		ent.addComponent<ScopedComponent>();
+		REQUIRE(attached == 1);
+	}
+}
+
+TEST_CASE("Owned scoped event listeners", "[event]")
+{
+	Kunlaboro::EntitySystem es;
+	auto& evs = es.getEventSystem();
+
+	auto owner = es.createEntity();
+	owner.addComponent<ScopedComponent>();
+	const auto ownerId = owner.getComponent<ScopedComponent>()->getId();
+
+	auto target = es.createEntity();
+	const auto targetId = target.getId();
+	const Kunlaboro::ComponentId component(0, 0, 0);
+
+	int entityCalls = 0, componentCalls = 0;
+	evs.registerScopedEvent<EntityKeyedEvent>(ownerId, targetId, [&entityCalls](const EntityKeyedEvent&) { ++entityCalls; });
+	evs.registerScopedEvent<ComponentKeyedEvent>(ownerId, component, [&componentCalls](const ComponentKeyedEvent&) { ++componentCalls; });
+
+	evs.emitEvent(EntityKeyedEvent{ targetId });
+	evs.emitEvent(ComponentKeyedEvent{ component });
+
+	CHECK(entityCalls == 1);
+	CHECK(componentCalls == 1);
+
+	// Despawning the owner takes its scoped listeners, and their buckets, along with it
+	es.destroyEntity(owner.getId());
+
+	CHECK_FALSE(evs.hasListeners<EntityKeyedEvent>());
+	CHECK_FALSE(evs.hasListeners<ComponentKeyedEvent>());
+
+	evs.emitEvent(EntityKeyedEvent{ targetId });
+	evs.emitEvent(ComponentKeyedEvent{ component });
+
+	CHECK(entityCalls == 1);
+	REQUIRE(componentCalls == 1);
+}
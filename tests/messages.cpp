@@ -95,3 +95,352 @@ TEST_CASE("Message passing locality", "[message]")
 	}
 }
 
+
+TEST_CASE("Message requests during dispatch", "[message]")
+{
+	Kunlaboro::EntitySystem es;
+	auto& ms = es.getMessageSystem();
+
+	ms.registerMessage<>("Dispatch.Test");
+	const auto mId = Kunlaboro::MessageSystem::hash("Dispatch.Test");
+
+	const Kunlaboro::ComponentId first(0, 0, 0), second(1, 0, 0), third(2, 0, 0);
+	int firstCalls = 0, secondCalls = 0, thirdCalls = 0;
+
+	ms.requestMessage<>(second, mId, [&]() { ++secondCalls; }, 1);
+	ms.requestMessage<>(first, mId, [&]() {
+		++firstCalls;
+
+		// Removes itself and the following request, and adds a new one
+		ms.unrequestMessage(first, mId);
+		ms.unrequestMessage(second, mId);
+		ms.requestMessage<>(third, mId, [&]() { ++thirdCalls; });
+	}, 0);
+
+	ms.sendMessage(mId);
+	CHECK(firstCalls == 1);
+	CHECK(secondCalls == 0);
+	CHECK(thirdCalls == 0);
+
+	ms.sendMessage(mId);
+	CHECK(firstCalls == 1);
+	CHECK(secondCalls == 0);
+	REQUIRE(thirdCalls == 1);
+}
+
+TEST_CASE("Entity-local messages", "[message]")
+{
+	Kunlaboro::EntitySystem es;
+	auto& ms = es.getMessageSystem();
+
+	ms.registerMessage<int>("Either.SetValue");
+	ms.registerMessage<int>("Global.SetValue", Kunlaboro::MessageSystem::Message_Global);
+	ms.registerMessage<int>("Local.SetValue", Kunlaboro::MessageSystem::Message_Local);
+	const auto mId = Kunlaboro::MessageSystem::hash("Either.SetValue");
+
+	auto first = es.createEntity();
+	auto second = es.createEntity();
+	first.addComponent<MessagingTestComponent>();
+	second.addComponent<MessagingTestComponent>();
+
+	auto firstComp = first.getComponent<MessagingTestComponent>();
+	auto secondComp = second.getComponent<MessagingTestComponent>();
+
+	ms.sendMessageTo(mId, first.getId(), 4);
+	CHECK(firstComp->getValue() == 4);
+	CHECK(secondComp->getValue() == 0);
+
+	ms.sendMessageTo(mId, second.getId(), 8);
+	CHECK(firstComp->getValue() == 4);
+	CHECK(secondComp->getValue() == 8);
+
+	ms.unrequestAllMessages(first.getId());
+	ms.sendMessage(mId, 15);
+	CHECK(firstComp->getValue() == 4);
+	REQUIRE(secondComp->getValue() == 15);
+}
+
+TEST_CASE("Message request priorities", "[message]")
+{
+	Kunlaboro::EntitySystem es;
+	auto& ms = es.getMessageSystem();
+
+	ms.registerMessage<std::string&>("Priority.Test");
+	const auto mId = Kunlaboro::MessageSystem::hash("Priority.Test");
+
+	// Large enough to not fit in the inline storage
+	const std::string padding(64, 'x');
+
+	ms.requestMessage<std::string&>(Kunlaboro::ComponentId(0, 0, 0), mId, [](std::string& out) { out += "a"; }, 2);
+	ms.requestMessage<std::string&>(Kunlaboro::ComponentId(1, 0, 0), mId, [](std::string& out) { out += "b"; }, 1);
+	ms.requestMessage<std::string&>(Kunlaboro::ComponentId(2, 0, 0), mId, [padding](std::string& out) { out += padding.substr(0, 1); }, 3);
+
+	std::string order;
+	ms.sendMessage<std::string&>(mId, order);
+	CHECK(order == "bax");
+
+	ms.reprioritizeMessage(Kunlaboro::ComponentId(2, 0, 0), mId, 0);
+	ms.unrequestMessage(Kunlaboro::ComponentId(1, 0, 0), mId);
+
+	order.clear();
+	ms.sendMessage<std::string&>(mId, order);
+	REQUIRE(order == "xa");
+}
+
+TEST_CASE("Directed sends to replaced requests", "[message]")
+{
+	Kunlaboro::EntitySystem es;
+	auto& ms = es.getMessageSystem();
+
+	ms.registerMessage<int&>("Directed.Test");
+	const auto mId = Kunlaboro::MessageSystem::hash("Directed.Test");
+	const Kunlaboro::ComponentId first(0, 0, 0), second(1, 0, 0);
+
+	// Keeps the tombstones from being compacted right away
+	for (int i = 2; i < 8; ++i)
+		ms.requestMessage<int&>(Kunlaboro::ComponentId(i, 0, 0), mId, [](int&) { }, 5);
+
+	SECTION("Re-requesting with a new priority")
+	{
+		int oldCalls = 0, newCalls = 0;
+		ms.requestMessage<int&>(first, mId, [&oldCalls](int&) { ++oldCalls; }, 10);
+		ms.requestMessage<int&>(first, mId, [&newCalls](int&) { ++newCalls; }, 0);
+
+		int value = 0;
+		ms.sendMessageTo<int&>(mId, first, value);
+
+		CHECK(oldCalls == 0);
+		REQUIRE(newCalls == 1);
+	}
+
+	SECTION("Unrequesting followed by an insert")
+	{
+		int calls = 0;
+		ms.requestMessage<int&>(first, mId, [&calls](int&) { ++calls; }, 10);
+		ms.unrequestAllMessages(first);
+		ms.requestMessage<int&>(second, mId, [](int&) { }, 0);
+
+		int value = 0;
+		ms.sendMessageTo<int&>(mId, first, value);
+
+		REQUIRE(calls == 0);
+	}
+}
+
+class MethodBindingTestComponent : public Kunlaboro::MessagingComponent
+{
+public:
+	MethodBindingTestComponent()
+		: mValue(0)
+	{ }
+
+	void addedToEntity()
+	{
+		requestMessageId<decltype(&MethodBindingTestComponent::addValue), &MethodBindingTestComponent::addValue>("Bound.AddValue");
+		requestMessageId<decltype(&MethodBindingTestComponent::appendName), &MethodBindingTestComponent::appendName>("Bound.AppendName", 1);
+	}
+
+	void addValue(int value)
+	{
+		mValue += value;
+	}
+	void appendName(std::string& out)
+	{
+		out += "bound";
+	}
+	int getValue() const
+	{
+		return mValue;
+	}
+
+private:
+	int mValue;
+};
+
+TEST_CASE("Compile-time method requests", "[message]")
+{
+	Kunlaboro::EntitySystem es;
+	auto& ms = es.getMessageSystem();
+
+	ms.registerMessage<int>("Bound.AddValue");
+	ms.registerMessage<std::string&>("Bound.AppendName");
+
+	auto ent = es.createEntity();
+	ent.addComponent<MethodBindingTestComponent>();
+	auto comp = ent.getComponent<MethodBindingTestComponent>();
+
+	ms.sendMessage("Bound.AddValue", 5);
+	ms.sendMessageTo("Bound.AddValue", comp->getId(), 2);
+	CHECK(comp->getValue() == 7);
+
+	std::string name;
+	ms.requestMessage<std::string&>(Kunlaboro::ComponentId(0, 0, 0), Kunlaboro::MessageSystem::hash("Bound.AppendName"), [](std::string& out) { out += "-"; }, 0);
+	ms.sendMessage<std::string&>("Bound.AppendName", name);
+	REQUIRE(name == "-bound");
+}
+
+struct TickChannel : public Kunlaboro::Channel<float> { };
+struct ResetChannel : public Kunlaboro::Channel<> { };
+
+TEST_CASE("Message channels", "[message]")
+{
+	Kunlaboro::EntitySystem es;
+	auto& ms = es.getMessageSystem();
+
+	auto ent = es.createEntity();
+	ent.addComponent<MessagingTestComponent>();
+	auto comp = ent.getComponent<MessagingTestComponent>();
+
+	float total = 0;
+	int resets = 0;
+	ms.request<TickChannel>(comp->getId(), [&total](float dt) { total += dt; });
+	ms.request<ResetChannel>(comp->getId(), [&resets]() { ++resets; });
+
+	ms.send<TickChannel>(0.5f);
+	ms.send<TickChannel>(1);
+	ms.send<ResetChannel>();
+	CHECK(total == 1.5f);
+	CHECK(resets == 1);
+
+	ms.sendTo<TickChannel>(comp->getId(), 2.f);
+	ms.sendTo<TickChannel>(ent.getId(), 4.f);
+	CHECK(total == 7.5f);
+
+	ms.unrequest<TickChannel>(comp->getId());
+	ms.send<TickChannel>(1.f);
+	CHECK(total == 7.5f);
+
+	ms.unrequestAllMessages(comp->getId());
+	ms.send<ResetChannel>();
+	REQUIRE(resets == 1);
+}
+
+struct TeardownEvent
+{
+	int Value;
+};
+
+TEST_CASE("Component teardown", "[message]")
+{
+	Kunlaboro::EntitySystem es;
+	auto& ms = es.getMessageSystem();
+	auto& evs = es.getEventSystem();
+
+	ms.registerMessage<>("Teardown.Test");
+	const auto mId = Kunlaboro::MessageSystem::hash("Teardown.Test");
+
+	auto first = es.createEntity();
+	auto second = es.createEntity();
+	first.addComponent<MessagingTestComponent>();
+	second.addComponent<MessagingTestComponent>();
+
+	const auto firstId = first.getComponent<MessagingTestComponent>()->getId();
+	const auto secondId = second.getComponent<MessagingTestComponent>()->getId();
+
+	int messages = 0, events = 0;
+	ms.requestMessage<>(firstId, mId, [&messages]() { ++messages; });
+	ms.requestMessage<>(secondId, mId, [&messages]() { ++messages; });
+	ms.request<ResetChannel>(firstId, [&messages]() { ++messages; });
+	evs.registerEvent<TeardownEvent>(firstId, [&events](const TeardownEvent&) { ++events; });
+	evs.registerEvent<TeardownEvent>(secondId, [&events](const TeardownEvent&) { ++events; });
+
+	es.destroyEntity(first.getId());
+
+	ms.sendMessage(mId);
+	ms.send<ResetChannel>();
+	evs.emitEvent<TeardownEvent>(1);
+
+	CHECK(messages == 1);
+	REQUIRE(events == 1);
+}
+
+TEST_CASE("Queued messages", "[message]")
+{
+	Kunlaboro::EntitySystem es;
+	auto& ms = es.getMessageSystem();
+
+	ms.registerMessage<int>("Queue.Test");
+	const auto mId = Kunlaboro::MessageSystem::hash("Queue.Test");
+
+	const Kunlaboro::ComponentId first(0, 0, 0), second(1, 0, 0);
+	std::vector<int> firstValues, secondValues;
+	ms.requestMessage<int>(first, mId, [&](int value) {
+		firstValues.push_back(value);
+
+		// Posted during the flush, so delivered on the next one
+		if (value == 1)
+			ms.postMessageTo(mId, first, 10);
+	});
+	ms.requestMessage<int>(second, mId, [&](int value) { secondValues.push_back(value); });
+
+	SECTION("Delivery")
+	{
+		ms.postMessage(mId, 1);
+		ms.postMessageTo(mId, second, 2);
+		CHECK(firstValues.empty());
+
+		ms.flush();
+		CHECK(firstValues == std::vector<int>({ 1 }));
+		CHECK(secondValues == std::vector<int>({ 1, 2 }));
+
+		ms.flush();
+		CHECK(firstValues == std::vector<int>({ 1, 10 }));
+		REQUIRE(secondValues == std::vector<int>({ 1, 2 }));
+	}
+
+	SECTION("Coalescing")
+	{
+		ms.setCoalescing(mId, true);
+
+		ms.postMessageTo(mId, second, 2);
+		ms.postMessageTo(mId, second, 3);
+		ms.postMessage(mId, 4);
+		ms.postMessage(mId, 5);
+		ms.flush();
+
+		CHECK(firstValues == std::vector<int>({ 5 }));
+		REQUIRE(secondValues == std::vector<int>({ 3, 5 }));
+	}
+
+	SECTION("Coalescing many receivers")
+	{
+		ms.setCoalescing(mId, true);
+
+		std::vector<int> received(100, 0), last(100, 0);
+		for (uint32_t i = 0; i < 100; ++i)
+			ms.requestMessage<int>(Kunlaboro::ComponentId(i + 2, 0, 0), mId, [&received, &last, i](int value) {
+				++received[i];
+				last[i] = value;
+			});
+
+		// Each frame starts with an empty index, while keeping its capacity
+		for (int frame = 0; frame < 2; ++frame)
+		{
+			for (int value = 0; value < 3; ++value)
+				for (uint32_t i = 0; i < 100; ++i)
+					ms.postMessageTo(mId, Kunlaboro::ComponentId(i + 2, 0, 0), frame * 10 + value);
+			ms.flush();
+
+			for (uint32_t i = 0; i < 100; ++i)
+			{
+				CHECK(received[i] == frame + 1);
+				CHECK(last[i] == frame * 10 + 2);
+			}
+		}
+
+		REQUIRE(firstValues.empty());
+	}
+
+	SECTION("Channels")
+	{
+		float total = 0;
+		ms.request<TickChannel>(first, [&total](float dt) { total += dt; });
+
+		ms.post<TickChannel>(0.5f);
+		ms.postTo<TickChannel>(first, 1.f);
+		CHECK(total == 0);
+
+		ms.flush();
+		REQUIRE(total == 1.5f);
+	}
+}
@@ -1,5 +1,8 @@
 #include <Kunlaboro/Component.hpp>
+#include <Kunlaboro/Entity.inl>
 #include <Kunlaboro/EntitySystem.inl>
+#include <Kunlaboro/Message.inl>
+#include <Kunlaboro/MessageSystem.inl>
 #include <Kunlaboro/Views.inl>
 #include "catch.hpp"
 
@@ -101,6 +104,32 @@ TEST_CASE("POD component destruction - 1 000 000", "[.performance][component]")
 	}
 }
 
+TEST_CASE("sparse POD component iteration - 1 000 000", "[.performance][component]")
+{
+	Kunlaboro::EntitySystem es;
+	auto family = Kunlaboro::ComponentFamily<PODComponent>::getFamily();
+
+	for (int i = 0; i < 1000000; ++i)
+		es.createComponent<PODComponent>().unlink();
+	for (int i = 0; i < 1000000; ++i)
+		if (i % 1000 != 0)
+			es.destroyComponent(Kunlaboro::ComponentId(i, 0, family));
+
+	CHECK(es.componentGetPool(family).countBits() == 1000);
+
+	SECTION("sparse POD iteration - forEach")
+	{
+		int count = 0;
+		auto view = Kunlaboro::ComponentView<PODComponent>(es);
+		for (int i = 0; i < 100; ++i)
+			view.forEach([&count](PODComponent&) {
+				++count;
+			});
+
+		CHECK(count == 100000);
+	}
+}
+
 TEST_CASE("POD component iteration - 1 000 000", "[.performance][component]")
 {
 	Kunlaboro::EntitySystem es;
@@ -127,6 +156,38 @@ TEST_CASE("POD component iteration - 1 000 000", "[.performance][component]")
 		});
 	}
 
+	SECTION("POD update - forEach")
+	{
+		auto view = Kunlaboro::ComponentView<PODComponent>(es);
+		for (int i = 0; i < 10; ++i)
+			view.forEach([](PODComponent& comp) {
+				comp.data += 1;
+			});
+
+		CHECK(view.transformReduce(uint64_t(0), [](uint64_t a, uint64_t b) { return a + b; }, [](PODComponent& comp) { return uint64_t(comp.data); }) == 10000000);
+	}
+
+	SECTION("POD update - forEachChunk")
+	{
+		auto view = Kunlaboro::ComponentView<PODComponent>(es);
+		for (int i = 0; i < 10; ++i)
+			view.forEachChunk([](PODComponent* comps, std::size_t count, const std::uint64_t* mask) {
+				if (!mask)
+				{
+					for (std::size_t j = 0; j < count; ++j)
+						comps[j].data += 1;
+				}
+				else
+				{
+					for (std::size_t j = 0; j < count; ++j)
+						if (mask[j / 64] & (1ull << (j % 64)))
+							comps[j].data += 1;
+				}
+			});
+
+		CHECK(view.transformReduce(uint64_t(0), [](uint64_t a, uint64_t b) { return a + b; }, [](PODComponent& comp) { return uint64_t(comp.data); }) == 10000000);
+	}
+
 	for (int i = 0; i < 1000000; ++i)
 		es.createComponent<PODComponentLargeChunks>().unlink();
 
@@ -150,6 +211,56 @@ TEST_CASE("POD component iteration - 1 000 000", "[.performance][component]")
 	}
 }
 
+struct AoSParticle : public Kunlaboro::Component
+{
+	float X, Y, Z;
+	float dX, dY, dZ;
+	float Life;
+};
+
+struct SoAParticle : public Kunlaboro::SoAComponent<SoAParticle, float, float, float, float, float, float, float>
+{
+	enum { X, Y, Z, dX, dY, dZ, Life };
+};
+
+TEST_CASE("particle update - 1 000 000", "[.performance][component]")
+{
+	Kunlaboro::EntitySystem es;
+	const float dt = 1.f / 60;
+
+	SECTION("array of structures - forEach")
+	{
+		for (int i = 0; i < 1000000; ++i)
+			es.createComponent<AoSParticle>().unlink();
+
+		auto view = Kunlaboro::ComponentView<AoSParticle>(es);
+		for (int step = 0; step < 10; ++step)
+			view.forEach([dt](AoSParticle& p) {
+				p.X += p.dX * dt;
+				p.Y += p.dY * dt;
+				p.Z += p.dZ * dt;
+			});
+	}
+
+	SECTION("structure of arrays - forEachFields")
+	{
+		for (int i = 0; i < 1000000; ++i)
+			es.createComponent<SoAParticle>().unlink();
+
+		auto view = Kunlaboro::ComponentView<SoAParticle>(es);
+		for (int step = 0; step < 10; ++step)
+			view.forEachFields([dt](std::size_t count, const std::uint64_t*, float* x, float* y, float* z, float* dx, float* dy, float* dz, float*) {
+				// Every slot is live in this test, so the mask can be ignored
+				for (std::size_t i = 0; i < count; ++i)
+				{
+					x[i] += dx[i] * dt;
+					y[i] += dy[i] * dt;
+					z[i] += dz[i] * dt;
+				}
+			});
+	}
+}
+
 TEST_CASE("non-POD component performance - 1 000 000", "[.performance][component]")
 {
 	Kunlaboro::EntitySystem es;
@@ -239,3 +350,63 @@ TEST_CASE("entity performance - 1 000 000", "[.performance][entity]")
 		}
 	}
 }
+
+class SpawnedMessagingComponent : public Kunlaboro::MessagingComponent
+{
+public:
+	void addedToEntity()
+	{
+		++calls;
+	}
+};
+
+TEST_CASE("messaging entity spawning - 100 000", "[.performance][message]")
+{
+	Kunlaboro::EntitySystem es;
+	calls = 0;
+
+	for (int i = 0; i < 100000; ++i)
+		es.createEntity().addComponent<SpawnedMessagingComponent>();
+
+	REQUIRE(calls == 100000);
+}
+
+TEST_CASE("entity despawning - 100 000", "[.performance][entity]")
+{
+	Kunlaboro::EntitySystem es;
+	calls = 0;
+
+	std::vector<Kunlaboro::EntityId> entities;
+	entities.reserve(100000);
+	for (int i = 0; i < 100000; ++i)
+		entities.push_back(es.createEntity().getId());
+
+	SECTION("Single events")
+	{
+		es.getEventSystem().registerEvent<Kunlaboro::EntitySystem::EntityDestroyedEvent>([](const Kunlaboro::EntitySystem::EntityDestroyedEvent&) {
+			++calls;
+		});
+
+		for (auto eid : entities)
+			es.destroyEntity(eid);
+
+		REQUIRE(calls == 100000);
+	}
+
+	SECTION("Batched events")
+	{
+		uint64_t count = 0;
+		es.getEventSystem().registerEvent<Kunlaboro::EntitySystem::EntitiesDestroyedEvent>([&count](const Kunlaboro::EntitySystem::EntitiesDestroyedEvent& ev) {
+			++calls;
+			count += ev.Count;
+		});
+
+		es.beginBatch();
+		for (auto eid : entities)
+			es.destroyEntity(eid);
+		es.endBatch();
+
+		CHECK(calls == 1);
+		REQUIRE(count == 100000);
+	}
+}
@@ -1,7 +1,13 @@
 #include <Kunlaboro/Component.hpp>
 #include <Kunlaboro/EntitySystem.hpp>
+#include <Kunlaboro/System.inl>
+#include <Kunlaboro/detail/JobQueue.hpp>
 #include "catch.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+
 TEST_CASE("Entity system creation")
 {
 	Kunlaboro::EntitySystem es;
@@ -10,3 +16,139 @@ TEST_CASE("Entity system creation")
 	REQUIRE(!es.isAlive(Kunlaboro::ComponentId(0,0,0)));
 	REQUIRE(!es.isAlive(Kunlaboro::EntityId(0,0)));
 }
+
+namespace
+{
+	struct SysPosition : public Kunlaboro::Component { float X; };
+	struct SysVelocity : public Kunlaboro::Component { float X; };
+	struct SysBrain : public Kunlaboro::Component { int State; };
+
+	class RecordingSystem : public Kunlaboro::System
+	{
+	public:
+		RecordingSystem(std::atomic<int>& clock)
+			: Started(-1)
+			, Finished(-1)
+			, Rendezvous(nullptr)
+			, RendezvousCount(0)
+			, Met(false)
+			, mClock(clock)
+		{ }
+
+		void update(float)
+		{
+			Started = mClock.fetch_add(1);
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+
+			// Wait for the other systems sharing the rendezvous to be running at the same time,
+			// giving up after a while instead of deadlocking if they never are.
+			if (Rendezvous)
+			{
+				Rendezvous->fetch_add(1);
+				const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+				while (Rendezvous->load() < RendezvousCount && std::chrono::steady_clock::now() < deadline)
+					std::this_thread::yield();
+				Met = Rendezvous->load() >= RendezvousCount;
+			}
+
+			Finished = mClock.fetch_add(1);
+		}
+
+		int Started, Finished;
+		std::atomic<int>* Rendezvous;
+		int RendezvousCount;
+		bool Met;
+
+	protected:
+		std::atomic<int>& mClock;
+	};
+
+	struct PhysicsSystem : public RecordingSystem
+	{
+		PhysicsSystem(std::atomic<int>& clock) : RecordingSystem(clock) { writes<SysPosition>(); reads<SysVelocity>(); }
+	};
+	struct AISystem : public RecordingSystem
+	{
+		AISystem(std::atomic<int>& clock) : RecordingSystem(clock) { writes<SysBrain>(); reads<SysPosition>(); }
+	};
+	struct AudioSystem : public RecordingSystem
+	{
+		AudioSystem(std::atomic<int>& clock) : RecordingSystem(clock) { reads<SysPosition>(); }
+	};
+	struct RenderSystem : public RecordingSystem
+	{
+		RenderSystem(std::atomic<int>& clock) : RecordingSystem(clock) { reads<SysPosition>(); }
+	};
+}
+
+TEST_CASE("System scheduling", "[system][threading]")
+{
+	Kunlaboro::EntitySystem es;
+	Kunlaboro::SystemScheduler scheduler(es);
+
+	std::atomic<int> clock(0);
+	auto& physics = scheduler.addSystem<PhysicsSystem>(clock);
+	auto& ai = scheduler.addSystem<AISystem>(clock);
+	auto& audio = scheduler.addSystem<AudioSystem>(clock);
+	auto& render = scheduler.addSystem<RenderSystem>(clock);
+
+	REQUIRE(scheduler.getSystemCount() == 4);
+	REQUIRE(physics.getEntitySystem() == &es);
+
+	SECTION("Conflict detection")
+	{
+		CHECK(physics.conflictsWith(ai));
+		CHECK(ai.conflictsWith(physics));
+		CHECK(physics.conflictsWith(audio));
+		CHECK(!audio.conflictsWith(render));
+		CHECK(!ai.conflictsWith(audio));
+	}
+
+	SECTION("Sequential update")
+	{
+		scheduler.update(0.1f);
+
+		REQUIRE(physics.Finished < ai.Started);
+		REQUIRE(ai.Finished < audio.Started);
+		REQUIRE(audio.Finished < render.Started);
+	}
+
+	SECTION("Parallel update")
+	{
+		Kunlaboro::detail::JobQueue queue(4);
+
+		// The non-conflicting systems can only all reach the rendezvous if they run concurrently.
+		std::atomic<int> rendezvous(0);
+		for (RecordingSystem* sys : { static_cast<RecordingSystem*>(&ai), static_cast<RecordingSystem*>(&audio), static_cast<RecordingSystem*>(&render) })
+		{
+			sys->Rendezvous = &rendezvous;
+			sys->RendezvousCount = 3;
+		}
+
+		for (int i = 0; i < 5; ++i)
+		{
+			rendezvous = 0;
+			scheduler.update(0.1f, queue);
+
+			REQUIRE(physics.Finished < ai.Started);
+			REQUIRE(physics.Finished < audio.Started);
+			REQUIRE(physics.Finished < render.Started);
+
+			REQUIRE(ai.Met);
+			REQUIRE(audio.Met);
+			REQUIRE(render.Met);
+		}
+	}
+
+	SECTION("System removal")
+	{
+		scheduler.removeSystem(ai);
+		REQUIRE(scheduler.getSystemCount() == 3);
+
+		Kunlaboro::detail::JobQueue queue(2);
+		scheduler.update(0.1f, queue);
+
+		REQUIRE(physics.Finished < audio.Started);
+		REQUIRE(physics.Finished < render.Started);
+	}
+}
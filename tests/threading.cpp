@@ -1,6 +1,397 @@
 #include <Kunlaboro/Component.hpp>
 #include <Kunlaboro/EntitySystem.hpp>
+#include <Kunlaboro/EventSystem.inl>
+#include <Kunlaboro/MessageSystem.inl>
+#include <Kunlaboro/detail/JobQueue.hpp>
 #include "catch.hpp"
 
 #include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
 #include <thread>
+
+TEST_CASE("Job queue", "[threading]")
+{
+	Kunlaboro::detail::JobQueue queue(4);
+
+	SECTION("Flat submission")
+	{
+		std::atomic<uint32_t> calls(0);
+
+		for (int i = 0; i < 10000; ++i)
+			queue.submit([&calls]() { calls.fetch_add(1, std::memory_order_relaxed); });
+		queue.wait();
+
+		REQUIRE(calls == 10000);
+	}
+
+	SECTION("Nested submission")
+	{
+		std::atomic<uint32_t> calls(0);
+
+		for (int i = 0; i < 100; ++i)
+			queue.submit([&queue, &calls]() {
+				for (int j = 0; j < 100; ++j)
+					queue.submit([&calls]() { calls.fetch_add(1, std::memory_order_relaxed); });
+			});
+		queue.wait();
+
+		REQUIRE(calls == 10000);
+	}
+
+	SECTION("Nested waiting")
+	{
+		std::atomic<uint32_t> calls(0), mismatches(0);
+
+		for (int i = 0; i < 16; ++i)
+			queue.submit([&queue, &calls, &mismatches]() {
+				std::atomic<uint32_t> local(0);
+				for (int j = 0; j < 100; ++j)
+					queue.submit([&calls, &local]() {
+						local.fetch_add(1, std::memory_order_relaxed);
+						calls.fetch_add(1, std::memory_order_relaxed);
+					});
+				queue.wait();
+
+				if (local != 100)
+					mismatches.fetch_add(1);
+			});
+		queue.wait();
+
+		REQUIRE(mismatches == 0);
+		REQUIRE(calls == 1600);
+	}
+
+	SECTION("Reuse after waiting")
+	{
+		std::atomic<uint32_t> calls(0);
+
+		for (int round = 0; round < 10; ++round)
+		{
+			for (int i = 0; i < 100; ++i)
+				queue.submit([&calls]() { calls.fetch_add(1, std::memory_order_relaxed); });
+			queue.wait();
+
+			REQUIRE(calls == uint32_t(100 * (round + 1)));
+		}
+
+		queue.wait(false);
+		queue.start();
+
+		queue.submit([&calls]() { calls.fetch_add(1, std::memory_order_relaxed); });
+		queue.wait();
+
+		REQUIRE(calls == 1001);
+	}
+
+	SECTION("Aborting discards queued jobs")
+	{
+		Kunlaboro::detail::JobQueue single(1);
+		std::atomic<bool> started(false), release(false);
+		std::atomic<uint32_t> calls(0);
+
+		single.submit([&started, &release]() {
+			started = true;
+			while (!release)
+				std::this_thread::yield();
+		});
+		for (int i = 0; i < 100; ++i)
+			single.submit([&calls]() { calls.fetch_add(1, std::memory_order_relaxed); });
+
+		while (!started)
+			std::this_thread::yield();
+
+		// The abort can only finish once the running job has been released
+		std::thread aborter([&single]() { single.abort(); });
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		release = true;
+		aborter.join();
+
+		REQUIRE(calls == 0);
+	}
+}
+
+struct ParallelChannel : public Kunlaboro::Channel<int> { };
+
+TEST_CASE("Delegate storage", "[threading]")
+{
+	typedef Kunlaboro::detail::Delegate<int()> Delegate;
+
+	struct Counted
+	{
+		Counted(int& live) : Live(&live) { ++*Live; }
+		Counted(const Counted& copy) : Live(copy.Live) { ++*Live; }
+		~Counted() { --*Live; }
+
+		int* Live;
+	};
+
+	int live = 0;
+	{
+		int count = 0;
+		Counted counted(live);
+		Delegate small([counted, count]() mutable { return ++count; });
+		Delegate large([counted, count]() { int padding[16] = { count }; return padding[0] + 1; });
+
+		CHECK(small() == 1);
+		CHECK(large() == 1);
+
+		// Copies own their own functor
+		Delegate copy(small);
+		CHECK(copy() == 2);
+		CHECK(copy() == 3);
+		CHECK(small() == 2);
+
+		Delegate moved(std::move(copy));
+		CHECK(!copy);
+		CHECK(moved() == 4);
+
+		copy = large;
+		moved = std::move(large);
+		CHECK(copy() == 1);
+		CHECK(moved() == 1);
+		CHECK(!large);
+
+		small.reset();
+		CHECK(!small);
+	}
+	REQUIRE(live == 0);
+
+	SECTION("Move-only functors")
+	{
+		std::unique_ptr<int> value(new int(5));
+		Delegate moveOnly([value = std::move(value)]() { return ++*value; });
+		Delegate shared(moveOnly);
+
+		CHECK(moveOnly() == 6);
+		REQUIRE(shared() == 7);
+	}
+}
+
+TEST_CASE("Parallel message dispatch", "[threading][message]")
+{
+	Kunlaboro::detail::JobQueue queue(4);
+	Kunlaboro::EntitySystem es;
+
+	auto& ms = es.getMessageSystem();
+	ms.setJobQueue(&queue);
+	ms.setThreadSafe<ParallelChannel>(true);
+
+	// Three priority bands, each band checks that the earlier ones are done
+	const uint32_t bandSize = 2000;
+	std::atomic<uint32_t> bands[3];
+	std::atomic<uint32_t> outOfOrder(0);
+	std::atomic<uint64_t> sum(0);
+	for (auto& band : bands)
+		band = 0;
+
+	for (uint32_t i = 0; i < bandSize * 3; ++i)
+	{
+		const auto band = i % 3;
+		ms.request<ParallelChannel>(Kunlaboro::ComponentId(i, 0, 0), [&, band](int value) {
+			for (uint32_t earlier = 0; earlier < band; ++earlier)
+				if (bands[earlier].load() != bandSize)
+					outOfOrder.fetch_add(1);
+
+			sum.fetch_add(value);
+			bands[band].fetch_add(1);
+		}, float(band));
+	}
+
+	ms.send<ParallelChannel>(2);
+
+	CHECK(outOfOrder == 0);
+	CHECK(bands[2] == bandSize);
+	REQUIRE(sum == bandSize * 3 * 2);
+}
+
+struct MailChannel : public Kunlaboro::Channel<uint32_t, uint32_t> { };
+
+TEST_CASE("Mailing from parallel dispatch", "[threading][message]")
+{
+	Kunlaboro::detail::JobQueue queue(4);
+	Kunlaboro::EntitySystem es;
+
+	auto& ms = es.getMessageSystem();
+	ms.setJobQueue(&queue);
+	ms.setThreadSafe<ParallelChannel>(true);
+
+	const uint32_t requestCount = 2000;
+	const auto mailbox = ms.createMailbox<MailChannel>(requestCount);
+	REQUIRE(mailbox);
+
+	// Thread-safe requests may only pass messages on through mailbox handles
+	std::atomic<uint32_t> unflagged(0);
+	for (uint32_t i = 0; i < requestCount; ++i)
+		ms.request<ParallelChannel>(Kunlaboro::ComponentId(i, 0, 0), [&mailbox, &unflagged, i](int value) {
+			if (!Kunlaboro::MessageSystem::inParallelDispatch())
+				unflagged.fetch_add(1);
+
+			mailbox.mail(i, uint32_t(value));
+		});
+
+	uint32_t received = 0, sum = 0;
+	ms.request<MailChannel>(Kunlaboro::ComponentId(0, 0, 0), [&received, &sum](uint32_t, uint32_t value) {
+		++received;
+		sum += value;
+	});
+
+	ms.send<ParallelChannel>(3);
+
+	CHECK(!Kunlaboro::MessageSystem::inParallelDispatch());
+	CHECK(unflagged == 0);
+	CHECK(received == 0);
+
+	ms.flush();
+
+	CHECK(received == requestCount);
+	REQUIRE(sum == requestCount * 3);
+}
+
+TEST_CASE("Message mailboxes", "[threading][message]")
+{
+	Kunlaboro::EntitySystem es;
+	auto& ms = es.getMessageSystem();
+
+	const uint32_t producerCount = 16;
+	const uint32_t messageCount = 10000;
+
+	// Small enough that producers will regularly find it full
+	const auto mailbox = ms.createMailbox<MailChannel>(256);
+	REQUIRE(mailbox);
+
+	std::vector<uint32_t> lastSeen(producerCount, 0);
+	uint32_t received = 0, outOfOrder = 0;
+	ms.request<MailChannel>(Kunlaboro::ComponentId(0, 0, 0), [&](uint32_t producer, uint32_t sequence) {
+		if (sequence != lastSeen[producer] + 1)
+			++outOfOrder;
+
+		lastSeen[producer] = sequence;
+		++received;
+	});
+
+	std::vector<std::thread> producers;
+	for (uint32_t producer = 0; producer < producerCount; ++producer)
+		producers.emplace_back([&ms, &mailbox, producer, messageCount]() {
+			// Half of the producers mail through the handle, the rest through a lookup
+			for (uint32_t sequence = 1; sequence <= messageCount; ++sequence)
+				while (!(producer % 2 == 0 ? mailbox.mail(producer, sequence) : ms.mail<MailChannel>(producer, sequence)))
+					std::this_thread::yield();
+		});
+
+	while (received < producerCount * messageCount)
+	{
+		ms.flush();
+		std::this_thread::yield();
+	}
+
+	for (auto& producer : producers)
+		producer.join();
+
+	ms.flush();
+
+	CHECK(outOfOrder == 0);
+	REQUIRE(received == producerCount * messageCount);
+}
+
+TEST_CASE("Mailbox handles", "[threading][message]")
+{
+	Kunlaboro::EntitySystem es;
+	auto& ms = es.getMessageSystem();
+
+	CHECK(!ms.createMailbox<int>(Kunlaboro::MessageSystem::hash("Mailbox.Missing"), 16));
+
+	ms.registerMessage<int>("Mailbox.Handle");
+	const auto mId = Kunlaboro::MessageSystem::hash("Mailbox.Handle");
+	const auto mailbox = ms.createMailbox<int>(mId, 64);
+	REQUIRE(mailbox);
+
+	int received = 0;
+	ms.requestMessage<int>(Kunlaboro::ComponentId(0, 0, 0), mId, [&received](int) { ++received; });
+
+	const int messageCount = 1000;
+	std::thread producer([&mailbox, messageCount]() {
+		for (int i = 0; i < messageCount; ++i)
+			while (!mailbox.mail(i))
+				std::this_thread::yield();
+	});
+
+	// Registering other messages rehashes the message map while the producer runs
+	int registered = 0;
+	while (received < messageCount)
+	{
+		if (registered < 1000)
+			ms.registerMessage<int>(("Mailbox.Other." + std::to_string(registered++)).c_str());
+		ms.flush();
+	}
+
+	producer.join();
+	REQUIRE(received == messageCount);
+}
+
+namespace
+{
+	struct AsyncTestEvent
+	{
+		uint32_t Sequence;
+	};
+
+	static_assert(!Kunlaboro::detail::IsBorrowedEvent<AsyncTestEvent>::value, "Owning events can be delivered asynchronously.");
+	static_assert(Kunlaboro::detail::IsBorrowedEvent<Kunlaboro::EntitySystem::EntitiesCreatedEvent>::value, "Batched events borrow their IDs.");
+}
+
+TEST_CASE("Asynchronous events", "[threading][event]")
+{
+	Kunlaboro::EntitySystem es;
+	auto& evs = es.getEventSystem();
+
+	const uint32_t eventCount = 10000;
+
+	// Only touched by the asynchronous listener, deliveries never overlap
+	uint32_t received = 0, outOfOrder = 0, lastSeen = 0;
+	std::thread::id deliveredOn;
+	const auto id = evs.registerAsyncEvent<AsyncTestEvent>([&](const AsyncTestEvent& ev) {
+		if (ev.Sequence != lastSeen + 1)
+			++outOfOrder;
+
+		lastSeen = ev.Sequence;
+		deliveredOn = std::this_thread::get_id();
+		++received;
+	});
+
+	SECTION("Job queue delivery")
+	{
+		Kunlaboro::detail::JobQueue queue(2);
+		evs.setJobQueue(&queue);
+
+		for (uint32_t sequence = 1; sequence <= eventCount; ++sequence)
+			evs.emitEvent<AsyncTestEvent>(sequence);
+		evs.drain();
+
+		CHECK(outOfOrder == 0);
+		CHECK(received == eventCount);
+
+		evs.unregisterEvent<AsyncTestEvent>(id);
+		evs.emitEvent<AsyncTestEvent>(eventCount + 1);
+		evs.drain();
+
+		REQUIRE(received == eventCount);
+		evs.setJobQueue(nullptr);
+	}
+
+	SECTION("Drain delivery")
+	{
+		for (uint32_t sequence = 1; sequence <= eventCount; ++sequence)
+			evs.emitEvent<AsyncTestEvent>(sequence);
+
+		// More events than the queue holds, so some were delivered when it filled up
+		CHECK(received < eventCount);
+
+		evs.drain();
+
+		CHECK(outOfOrder == 0);
+		CHECK(received == eventCount);
+		REQUIRE(deliveredOn == std::this_thread::get_id());
+	}
+}